@@ -5,1013 +5,1361 @@
 // https://inst.eecs.berkeley.edu/~cs61c/fa17/img/riscvcard.pdf
 // int のサイズは 4 bytes
 // void * のサイズは 8 bytes
+//
+// 関数は gen_ir で IR にして、regalloc でレジスタを割り当ててから出力する。
+// フレームは上から
+//   ra, fp (fp はここを指す)
+//   (可変長引数のときは a1-a7 の置き場。fp はさらに 64 下がる)
+//   ローカル変数 (fp - var->offset)
+//   スピルした仮想レジスタ
+//   保存した s レジスタ
+// の順に並ぶ。t5, t6 はスピルした値の出し入れに使う。
+//
+// 可変長引数をとらない関数では fp を使わない。sp は関数の中で動かないので、
+// fp からのオフセットは sp からのオフセットに直して使う。関数を呼ばなければ
+// ra も保存しないので、フレームに何も置かない関数はプロローグが空になる。
+//
+// return はすべて関数の末尾にひとつだけ置いたエピローグに飛ぶ。
+// 先頭から、フレームを使わないブロックだけを通って return する道があれば、
+// プロローグはそこを抜けた先のブロックに置き、その道では何もせず ret する
+// (shrink-wrapping)。
+//
+// 関数を抜ける直前の呼び出し (IR_TAILCALL) は、エピローグと同じように
+// フレームを片づけてから tail で飛ぶ。ra はもとの呼び出し元のまま残る。
+//
+// -march=rv64gcv のときは gen_ir がベクトル化したループに RVV の命令を使う。
+// ベクトルレジスタは gen_ir が番号まで決めている。
+//
+// 関数の中身は Inst の列としてためておき、peephole をかけて、schedule で
+// 並べかえてから出力する。
+
+static IRFunc *codegen_fn;
+static int frame_locals_size; // ローカル変数の領域の大きさ
+static int frame_size;        // fp から sp までの大きさ
+static bool use_fp;           // fp を使うか
+static bool has_call;         // 関数を呼ぶか。呼ぶなら ra を保存する
+static List *insts;           // of Inst *, 出力中の関数の命令
+static List *jump_tables;     // of IR *, 出力中の関数の IR_SWITCH
+static BB *prologue_bb;       // プロローグを置くブロック。NULL なら関数の先頭
+static char *before_prologue; // fn->bbs の順に、プロローグより前のブロックか
+static bool frame_ready;      // 出力中のブロックでプロローグを通ったか
+static int epilogue_label;    // エピローグのラベル
+static bool epilogue_used;    // エピローグに飛ぶ return があったか
+static int num_jump_tables;   // これまでの関数で出力した表の数
+
+static char *reg_name(int rn) {
+  switch (rn) {
+  case 0:
+    return "zero";
+  case 1:
+    return "ra";
+  case 2:
+    return "sp";
+  case 3:
+    return "gp";
+  case 4:
+    return "tp";
+  case 5:
+    return "t0";
+  case 6:
+    return "t1";
+  case 7:
+    return "t2";
+  case 8:
+    return "fp";
+  case 9:
+    return "s1";
+  case 10:
+    return "a0";
+  case 11:
+    return "a1";
+  case 12:
+    return "a2";
+  case 13:
+    return "a3";
+  case 14:
+    return "a4";
+  case 15:
+    return "a5";
+  case 16:
+    return "a6";
+  case 17:
+    return "a7";
+  case 18:
+    return "s2";
+  case 19:
+    return "s3";
+  case 20:
+    return "s4";
+  case 21:
+    return "s5";
+  case 22:
+    return "s6";
+  case 23:
+    return "s7";
+  case 24:
+    return "s8";
+  case 25:
+    return "s9";
+  case 26:
+    return "s10";
+  case 27:
+    return "s11";
+  case 28:
+    return "t3";
+  case 29:
+    return "t4";
+  case 30:
+    return "t5";
+  case 31:
+    return "t6";
+  }
 
-// これ addi 4 にしたら死んだ
-static void codegen_pop_t0() {
-  printf("  # pop t0 {{{\n");
-  printf("  ld t0, 0(sp)\n");
-  printf("  addi sp, sp, 8\n");
-  printf("  # }}}\n");
+  error("unknown register: x%d", rn);
 }
 
-static void codegen_pop_t1() {
-  printf("  # pop t1 {{{\n");
-  printf("  ld t1, 0(sp)\n");
-  printf("  addi sp, sp, 8\n");
-  printf("  # }}}\n");
+static Inst *emit(InstKind kind, char *op, int rd, int rs1, int rs2,
+                  int imm) {
+  Inst *inst = arena_calloc(codegen_arena, 1, sizeof(Inst));
+  inst->kind = kind;
+  inst->op = op;
+  inst->rd = rd;
+  inst->rs1 = rs1;
+  inst->rs2 = rs2;
+  inst->imm = imm;
+  list_append(insts, inst);
+  return inst;
 }
 
-static void codegen_pop_discard() {
-  printf("  # pop\n");
-  printf("  addi sp, sp, 8\n");
+static void emit_rrr(char *op, int rd, int rs1, int rs2) {
+  emit(INST_RRR, op, rd, rs1, rs2, 0);
 }
 
-static void codegen_push_t0() {
-  printf("  # push t0 {{{\n");
-  printf("  sd t0, -8(sp)\n");
-  printf("  addi sp, sp, -8\n");
-  printf("  # }}}\n");
+static void emit_rri(char *op, int rd, int rs1, int imm) {
+  emit(INST_RRI, op, rd, rs1, -1, imm);
 }
 
-Node *curr_func;
+static void emit_rr(char *op, int rd, int rs1) {
+  emit(INST_RR, op, rd, rs1, -1, 0);
+}
 
-static int func_locals_offset(Node *func) {
-  assert(func->kind == ND_FUNCDECL);
+static void emit_li(int rd, int imm) {
+  emit(INST_LI, "li", rd, -1, -1, imm);
+}
 
-  if (func->locals->len == 0) {
-    return 0;
+static void emit_sym(InstKind kind, char *op, int rt, int base, char *sym) {
+  Inst *inst;
+  if (kind == INST_STORE_LO) {
+    inst = emit(kind, op, -1, base, rt, 0);
+  } else {
+    inst = emit(kind, op, rt, base, -1, 0);
   }
+  inst->sym = sym;
+}
 
-  Var *last = func->locals->data[func->locals->len - 1];
-  return last->offset;
+static void emit_text(char *text) {
+  Inst *inst = emit(INST_TEXT, NULL, -1, -1, -1, 0);
+  inst->sym = text;
 }
 
-static int curr_varargs_index() {
-  if (curr_func->args == NULL)
-    return -1;
+// ベクトル命令。x レジスタはテキストに書いたうえで、peephole のために
+// rd, rs1, rs2 にも持っておく
+static void emit_vec(int rd, int rs1, int rs2, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char *text = arena_calloc(codegen_arena, 64, 1);
+  vsnprintf(text, 64, fmt, ap);
 
-  for (int i = 0; i < curr_func->args->len; i++) {
-    Node *node = curr_func->args->data[i];
-    if (node->kind == ND_VARARGS) {
-      return i;
-    }
-  }
+  Inst *inst = emit(INST_VEC, NULL, rd, rs1, rs2, 0);
+  inst->sym = text;
+}
 
-  return -1;
+static bool is_imm12(int imm) {
+  return -2048 <= imm && imm <= 2047;
 }
 
-static void codegen_prologue() {
-  printf("  # Prologue\n");
-  printf("  sd ra, -8(sp)\n");  // ra を保存
-  printf("  sd fp, -16(sp)\n"); // fp を保存
-  printf("  addi fp, sp, -16\n");
-  // スタックポインタを移動。codegen_epilogue で戻す関数を抜けるまで動かない
-  printf("  addi sp, sp, -%d\n",
-         func_locals_offset(curr_func) + 16 /* for saved ra, fp */);
+static bool is_saved_reg(int rn) {
+  return rn == 9 || (18 <= rn && rn <= 27);
+}
 
-  // varargs_index != -1 なら fp をさらに 64 下げる
-  // そして a1-a7 を fp+8 から fp+56 にコピーする
-  // 仕様的に a0 に対応する named arg は必ず存在するので置く必要なし
-  // FIXME: fp のほうが sp より下にあるので push したら消えていきそうな……
-  int varargs_index = curr_varargs_index();
-  if (varargs_index != -1) {
-    printf("  # prepare for varargs\n");
-    printf("  addi fp, fp, -64\n");
-    for (int i = 1; i <= 7; i++) {
-      printf("  sd a%d, %d(fp)\n", i, i * 8);
-    }
-    printf("  addi sp, sp, -64\n");
+// rd = rs + imm。即値に収まらないときは t6 を使う
+// fp を使わないときは fp からのオフセットを sp からのものに直す
+static int frame_base(int base, int *offset) {
+  if (base == REG_FP && !use_fp) {
+    *offset = *offset + frame_size;
+    return REG_SP;
   }
-
-  printf("\n");
+  return base;
 }
 
-// a0 に返り値を設定してから呼ぶこと
-static void codegen_epilogue() {
-  printf("\n");
-  printf("  # Epilogue\n");
-  int varargs_index = curr_varargs_index();
-  if (varargs_index != -1) {
-    printf("  addi sp, sp, 64\n");
+static void codegen_addi(int rd, int rs, int imm) {
+  rs = frame_base(rs, &imm);
+  if (is_imm12(imm)) {
+    emit_rri("addi", rd, rs, imm);
+    return;
   }
-  // sp を戻す
-  printf("  addi sp, sp, %d\n", func_locals_offset(curr_func) + 16);
-  // fp も戻す
-  // ここ lw にしたらおかしくなった
-  printf("  ld fp, -16(sp)\n");
-  // ra も戻す
-  printf("  ld ra, -8(sp)\n");
 
-  printf("  ret\n");
+  emit_li(REG_T6, imm);
+  emit_rrr("add", rd, rs, REG_T6);
 }
 
-static void codegen_expr(Node *node);
+static void emit_mem(char *op, int rt, int base, int offset) {
+  if (op[0] == 's') {
+    emit(INST_STORE, op, -1, base, rt, offset);
+  } else {
+    emit(INST_LOAD, op, rt, base, -1, offset);
+  }
+}
 
-// Var である node のアドレスを push する
-// または、ポインタの deref を計算してアドレスを push する
-static void codegen_push_lvalue(Node *node) {
-  if (node->kind == ND_LVAR) {
-    printf("  # (lvalue) address for '%.*s'\n", node->lvar->len,
-           node->lvar->name);
-    printf("  addi t0, fp, -%d\n", node->lvar->offset);
-    codegen_push_t0();
+// "ld rt, offset(base)" のようなメモリアクセス。
+// オフセットが即値に収まらないときは t6 でアドレスを計算する
+static void codegen_mem(char *op, int rt, int base, int offset) {
+  base = frame_base(base, &offset);
+  if (is_imm12(offset)) {
+    emit_mem(op, rt, base, offset);
     return;
   }
 
-  // *y -> y の値をアドレスとして push する
-  // y が配列のときは *y[0] みたいな感じであつかう
-  // **z -> (*z) の値をアドレスとして push する
-  if (node->kind == ND_DEREF) {
-    printf("  # (lvalue) deref address of (%s)\n",
-           type_to_string(typeof_node(node->lhs)));
-    codegen_expr(node->lhs);
-    return;
+  if (base == REG_T6) {
+    error("offset too large: %d", offset);
   }
+  emit_li(REG_T6, offset);
+  emit_rrr("add", REG_T6, base, REG_T6);
+  emit_mem(op, rt, REG_T6, 0);
+}
 
-  if (node->kind == ND_GVAR) {
-    printf("  # (lvalue) address for global variable '%.*s'\n", node->gvar->len,
-           node->gvar->name);
-    printf("  lui t0, %%hi(%.*s)\n", node->gvar->len, node->gvar->name);
-    printf("  addi t0, t0, %%lo(%.*s)\n", node->gvar->len, node->gvar->name);
-    codegen_push_t0();
-    return;
+static char *load_op(int size) {
+  switch (size) {
+  case 1:
+    return "lb";
+  case 4:
+    return "lw";
+  case 8:
+    return "ld";
   }
 
-  if (node->kind == ND_MEMBER) {
-    Type *type = typeof_node(node->lhs);
-    Var *member = find_var(type->members, node->ident->str, node->ident->len);
-    if (member == NULL) {
-      error("member not found: %.*s on (%s)", node->ident->len,
-            node->ident->str, type_to_string(type));
-    }
+  error("unknown size to load: %d", size);
+}
 
-    codegen_push_lvalue(node->lhs);
-    codegen_pop_t0();
-    printf("  # (lvalue) address for member '%.*s'\n", node->ident->len,
-           node->ident->str);
-    printf("  addi t0, t0, %d\n", member->offset);
-    codegen_push_t0();
-    return;
+static char *store_op(int size) {
+  switch (size) {
+  case 1:
+    return "sb";
+  case 4:
+    return "sw";
+  case 8:
+    return "sd";
   }
 
-  error_at(node->source_pos, "not an lvalue: %s", node_kind_to_str(node->kind));
+  error("unknown size to store: %d", size);
 }
 
-static void codegen_builtin_va_start(Node *ap);
+static int spill_offset(Reg *reg) {
+  return 0 - (frame_locals_size + (reg->spill_slot + 1) * 8);
+}
 
-// かならず何かしらの値をひとつだけ push した状態で返ってくること
-static void codegen_expr(Node *node) {
-  switch (node->kind) {
-  case ND_NUM:
-    printf("  # constant '%d'\n", node->val);
-    printf("  li t0, %d\n", node->val);
+// 保存した s レジスタの置き場の先頭。ここから下に並べる
+static int saved_regs_offset() {
+  return 0 - (frame_locals_size + codegen_fn->num_spill_slots * 8);
+}
 
-    // push
-    codegen_push_t0();
-    return;
+// 仮想レジスタの値が入っている物理レジスタ。
+// スピルしていれば scratch に読みこむ
+static int codegen_use(Reg *reg, int scratch) {
+  if (reg->rn >= 0) {
+    return reg->rn;
+  }
 
-  case ND_LT:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+  codegen_mem("ld", scratch, REG_FP, spill_offset(reg));
+  return scratch;
+}
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+// 仮想レジスタに書くときの物理レジスタ。スピルしていれば t5 に書き、
+// codegen_def でスロットに書き戻す
+static int codegen_dst(Reg *reg) {
+  if (reg->rn >= 0) {
+    return reg->rn;
+  }
+  return REG_T5;
+}
 
-    printf("  slt t0, t0, t1\n");
+static void codegen_def(Reg *reg, int rn) {
+  if (reg->rn < 0) {
+    codegen_mem("sd", rn, REG_FP, spill_offset(reg));
+  }
+}
 
-    codegen_push_t0();
+// size バイトに切りつめて符号拡張しつつ rs を rd に移す
+static void codegen_move(int rd, int rs, int size) {
+  switch (size) {
+  case 1:
+    emit_rri("slli", rd, rs, 56);
+    emit_rri("srai", rd, rd, 56);
+    return;
+  case 4:
+    emit_rr("sext.w", rd, rs);
+    return;
+  case 8:
+    if (rd != rs) {
+      emit_rr("mv", rd, rs);
+    }
     return;
+  }
 
-  case ND_GE:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+  error("unknown size to move: %d", size);
+}
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+// dst[i] = src[i] をまとめて行う。移し先がまだ読まれていない移し元の
+// こともあるので、読まれ終わったものから移す。循環していたら t6 を経由する
+static void codegen_parallel_move(int *dst, int *src, int *size, int n) {
+  int done[8];
+  for (int i = 0; i < n; i++) {
+    done[i] = dst[i] == src[i] && size[i] == 8;
+  }
 
-    printf("  slt t0, t0, t1\n");
-    printf("  xori t0, t0, 1\n");
+  for (;;) {
+    bool remaining = false;
+    bool progress = false;
 
-    codegen_push_t0();
-    return;
+    for (int i = 0; i < n; i++) {
+      if (done[i]) {
+        continue;
+      }
+      remaining = true;
 
-  case ND_ADD:
-  case ND_SUB: {
-    int lptr_size = 0;
-    int rptr_size = 0;
+      bool blocked = false;
+      for (int j = 0; j < n; j++) {
+        if (j != i && !done[j] && src[j] == dst[i]) {
+          blocked = true;
+        }
+      }
+      if (blocked) {
+        continue;
+      }
 
-    // TODO: ltype しかみてないけど rtype もみたいよね
-    Type *ltype = typeof_node(node->lhs);
-    if (ltype->ty == TY_PTR || ltype->ty == TY_ARRAY) {
-      lptr_size = sizeof_type(ltype->base);
+      codegen_move(dst[i], src[i], size[i]);
+      done[i] = 1;
+      progress = true;
     }
 
-    Type *rtype = typeof_node(node->rhs);
-    if (rtype->ty == TY_PTR || rtype->ty == TY_ARRAY) {
-      rptr_size = sizeof_type(rtype->base);
+    if (!remaining) {
+      return;
+    }
+    if (progress) {
+      continue;
     }
 
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
-
-    printf("  # pointer arithmetic: ltype=(%s), rtype=(%s)\n",
-           type_to_string(ltype), type_to_string(rtype));
-
-    if (lptr_size > 1) {
-      if (rptr_size > 1) {
-        if (node->kind != ND_SUB) {
-          error("must not happen (bug in parser)");
-        }
-        if (lptr_size != rptr_size) {
-          error("pointer arithmetic with different pointer types");
-        }
-        codegen_pop_t1();
-        codegen_pop_t0();
-
-        // ptr (t0) - ptr (t1)
-        // 減算したうえで base の size で割る
-        printf("  sub t0, t0, t1\n");
-        printf("  # do pointer arithmetic\n");
-        printf("  li t3, %d\n", lptr_size);
-        printf("  div t0, t0, t3\n");
-        codegen_push_t0();
-        return;
-      } else {
-        // ptr (t0) + int (t1)
-        // int のほうを size 倍する
-        codegen_pop_t1();
-        printf("  # do pointer arithmetic\n");
-        printf("  li t3, %d\n", lptr_size);
-        printf("  mul t1, t1, t3\n");
+    // 循環しているので、ひとつを t6 に逃がす
+    int from = -1;
+    for (int i = 0; i < n; i++) {
+      if (from == -1 && !done[i]) {
+        from = src[i];
       }
-    } else {
-      // こっちは普通の加減算
-      codegen_pop_t1();
     }
-
-    codegen_pop_t0();
-
-    if (node->kind == ND_ADD) {
-      printf("  add t0, t0, t1\n");
-    } else if (node->kind == ND_SUB) {
-      printf("  sub t0, t0, t1\n");
-    } else {
-      assert(0);
+    emit_rr("mv", REG_T6, from);
+    for (int i = 0; i < n; i++) {
+      if (!done[i] && src[i] == from) {
+        src[i] = REG_T6;
+      }
     }
+  }
+}
 
-    codegen_push_t0();
-    return;
+// fp を使わないときに sp を動かす大きさ。関数を呼ぶなら ra の置き場もとる
+static int frame_size_without_fp() {
+  if (has_call) {
+    return frame_size + 16;
   }
+  return frame_size;
+}
 
-  case ND_MUL:
-  case ND_DIV:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+static void codegen_prologue() {
+  emit_text("  # Prologue");
+  if (use_fp) {
+    emit_mem("sd", REG_RA, REG_SP, -8);  // ra を保存
+    emit_mem("sd", REG_FP, REG_SP, -16); // fp を保存
+    emit_rri("addi", REG_FP, REG_SP, -16);
+    // スタックポインタを移動。関数を抜けるまで動かない
+    codegen_addi(REG_SP, REG_SP, 0 - (frame_size + 16));
+  } else {
+    if (frame_size_without_fp() > 0) {
+      codegen_addi(REG_SP, REG_SP, 0 - frame_size_without_fp());
+    }
+    if (has_call) {
+      codegen_mem("sd", REG_RA, REG_SP, frame_size + 8);
+    }
+  }
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+  // varargs_index != -1 なら fp をさらに 64 下げる
+  // そして a1-a7 を fp+8 から fp+56 にコピーする
+  // 仕様的に a0 に対応する named arg は必ず存在するので置く必要なし
+  if (codegen_fn->varargs_index != -1) {
+    emit_text("  # prepare for varargs");
+    emit_rri("addi", REG_FP, REG_FP, -64);
+    for (int i = 1; i <= 7; i++) {
+      emit_mem("sd", REG_A0 + i, REG_FP, i * 8);
+    }
+    emit_rri("addi", REG_SP, REG_SP, -64);
+  }
 
-    if (node->kind == ND_MUL) {
-      printf("  mul t0, t0, t1\n");
-    } else if (node->kind == ND_DIV) {
-      printf("  div t0, t0, t1\n");
-    } else {
-      assert(0);
+  // 使う s レジスタを保存する
+  int offset = saved_regs_offset();
+  for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+    if (codegen_fn->used_regs[rn] && is_saved_reg(rn)) {
+      offset -= 8;
+      codegen_mem("sd", rn, REG_FP, offset);
     }
+  }
 
-    codegen_push_t0();
-    return;
+  emit_text("");
+}
 
-  case ND_EQ:
-  case ND_NE:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+// フレームに何も置かず、エピローグが ret だけになるか
+static bool is_frameless() {
+  return !use_fp && frame_size_without_fp() == 0;
+}
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+// s レジスタ、ra、fp、sp を関数に入ったときの値に戻す
+static void codegen_restore_frame() {
+  int offset = saved_regs_offset();
+  for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+    if (codegen_fn->used_regs[rn] && is_saved_reg(rn)) {
+      offset -= 8;
+      codegen_mem("ld", rn, REG_FP, offset);
+    }
+  }
 
-    printf("  xor t0, t0, t1\n");
-    if (node->kind == ND_EQ) {
-      printf("  seqz t0, t0\n");
+  if (use_fp) {
+    // sp を戻す
+    if (codegen_fn->varargs_index != -1) {
+      emit_rri("addi", REG_SP, REG_FP, 80);
     } else {
-      printf("  snez t0, t0\n");
+      emit_rri("addi", REG_SP, REG_FP, 16);
     }
+    // fp も戻す
+    emit_mem("ld", REG_FP, REG_SP, -16);
+    // ra も戻す
+    emit_mem("ld", REG_RA, REG_SP, -8);
+  } else {
+    if (has_call) {
+      codegen_mem("ld", REG_RA, REG_SP, frame_size + 8);
+    }
+    if (frame_size_without_fp() > 0) {
+      codegen_addi(REG_SP, REG_SP, frame_size_without_fp());
+    }
+  }
+}
 
-    codegen_push_t0();
-    return;
+// a0 に返り値を設定してから呼ぶこと
+static void codegen_epilogue() {
+  emit_text("  # Epilogue");
+  codegen_restore_frame();
+  emit(INST_RET, "ret", -1, -1, -1, 0);
+}
 
-  case ND_LOGOR:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+// 関数の先頭に並んだ IR_PARAM をまとめて処理して、処理した命令の数を返す
+static int codegen_params(BB *bb) {
+  int dst[8];
+  int src[8];
+  int size[8];
+  int n = 0;
+
+  int i = 0;
+  for (; i < bb->irs->len; i++) {
+    IR *ir = bb->irs->data[i];
+    if (ir->kind != IR_PARAM) {
+      break;
+    }
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+    int arg = REG_A0 + ir->imm;
+    if (ir->d->rn < 0) {
+      // スピルした引数は、ほかの引数を動かす前にスロットに書いておく
+      codegen_move(REG_T5, arg, ir->size);
+      codegen_mem("sd", REG_T5, REG_FP, spill_offset(ir->d));
+      continue;
+    }
 
-    printf("  or t0, t0, t1\n");
-    printf("  snez t0, t0\n");
+    dst[n] = ir->d->rn;
+    src[n] = arg;
+    size[n] = ir->size;
+    n++;
+  }
 
-    codegen_push_t0();
-    return;
+  codegen_parallel_move(dst, src, size, n);
+  return i;
+}
 
-  case ND_LOGAND:
-    codegen_expr(node->lhs); // -> t0
-    codegen_expr(node->rhs); // -> t1
+// 引数を a0- に置く
+static void codegen_args(IR *ir) {
+  int dst[8];
+  int src[8];
+  int size[8];
+  int n = 0;
+
+  for (int i = 0; i < ir->args->len; i++) {
+    Reg *arg = ir->args->data[i];
+    if (arg->rn >= 0) {
+      dst[n] = REG_A0 + i;
+      src[n] = arg->rn;
+      size[n] = 8;
+      n++;
+    }
+  }
+  codegen_parallel_move(dst, src, size, n);
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+  // スピルしていた引数は最後にスロットから直接読む
+  for (int i = 0; i < ir->args->len; i++) {
+    Reg *arg = ir->args->data[i];
+    if (arg->rn < 0) {
+      codegen_mem("ld", REG_A0 + i, REG_FP, spill_offset(arg));
+    }
+  }
+}
 
-    printf("  snez t0, t0\n");
-    printf("  snez t1, t1\n");
-    printf("  and t0, t0, t1\n");
+// call や tail の命令
+static void emit_call_inst(InstKind kind, char *op, IR *ir) {
+  Inst *inst = emit(kind, op, -1, -1, -1, ir->args->len);
+  inst->sym = arena_calloc(codegen_arena, ir->ident->len + 1, 1);
+  snprintf(inst->sym, ir->ident->len + 1, "%.*s", ir->ident->len,
+           token_str(ir->ident));
+}
 
-    codegen_push_t0();
-    return;
+static void codegen_call(IR *ir) {
+  codegen_args(ir);
+  emit_call_inst(INST_CALL, "call", ir);
 
-  case ND_LVAR:
-    if (node->lvar->type->ty == TY_ARRAY) {
-      // 配列の場合は先頭要素へのポインタに変換されるのでアドレスを push
-      // sizeof, & の場合だけ例外だがそれはそちら側で処理されてる。はず。
-      // ここ add でも通ってたけどいいのか？？
-      printf("  # lvar (array) '%.*s'\n", node->lvar->len, node->lvar->name);
-      printf("  addi t0, fp, -%d\n", node->lvar->offset);
-    } else {
-      printf("  # lvar '%.*s'\n", node->lvar->len, node->lvar->name);
-
-      int size = sizeof_type(node->lvar->type);
-
-      switch (size) {
-      case 1:
-        printf("  lb t0, -%d(fp)\n", node->lvar->offset);
-        break;
-      case 4:
-        printf("  lw t0, -%d(fp)\n", node->lvar->offset);
-        break;
-      case 8:
-        printf("  ld t0, -%d(fp)\n", node->lvar->offset);
-        break;
-      default:
-        error("unknown size of lvar: (%s)",
-              type_to_string(typeof_node(node->lhs)));
-      }
-    }
-    codegen_push_t0();
-    return;
+  if (ir->d->rn >= 0) {
+    codegen_move(ir->d->rn, REG_A0, 8);
+  } else {
+    codegen_def(ir->d, REG_A0);
+  }
+}
 
-  case ND_ASSIGN:
-    printf("  # ND_ASSIGN {{{\n");
-    // -> t0
-    codegen_push_lvalue(node->lhs);
-    // -> t1
-    codegen_expr(node->rhs);
+// 引数を置いてからフレームを片づけて、ra を変えずに飛ぶ。
+// スピルした引数をスロットから読むので、片づけるのはそのあと
+static void codegen_tail_call(IR *ir) {
+  codegen_args(ir);
+  if (frame_ready && !is_frameless()) {
+    codegen_restore_frame();
+  }
+  emit_call_inst(INST_TAIL, "tail", ir);
+}
 
-    codegen_pop_t1();
-    codegen_pop_t0();
+// ロード、ストアするアドレスを base + *offset の形にする
+static int codegen_mem_base(IR *ir, int *offset) {
+  if (ir->lvar != NULL) {
+    *offset = 0 - ir->lvar->offset + ir->imm;
+    return REG_FP;
+  }
 
-    printf("  # assign to variable '%.*s'\n", node->lhs->source_len,
-           node->lhs->source_pos);
+  *offset = ir->imm;
+  return codegen_use(ir->a, REG_T6);
+}
 
-    switch (sizeof_type(typeof_node(node->lhs))) {
-    case 1:
-      printf("  sb t1, 0(t0)\n");
-      break;
-    case 4:
-      printf("  sw t1, 0(t0)\n");
-      break;
-    case 8:
-      printf("  sd t1, 0(t0)\n");
-      break;
-    default:
-      error("unknown size of variable: (%s)",
-            type_to_string(typeof_node(node->lhs)));
-    }
+static char *symbol(Var *gvar, int offset) {
+  int len = gvar->len + 16;
+  char *buf = arena_calloc(codegen_arena, len, 1);
+  if (offset == 0) {
+    snprintf(buf, len, "%.*s", gvar->len, gvar->name);
+  } else {
+    snprintf(buf, len, "%.*s+%d", gvar->len, gvar->name, offset);
+  }
+  return buf;
+}
+
+static void emit_jump(BB *bb) {
+  emit(INST_JUMP, "j", -1, -1, -1, bb->label);
+}
 
-    printf("  mv t0, t1\n");
-    codegen_push_t0();
+static void codegen_branch_to(char *op, int a, int b, BB *bb) {
+  emit(INST_BRANCH, op, -1, a, b, bb->label);
+}
 
-    printf("  # }}} ND_ASSIGN\n");
+// 条件分岐。条件が成り立てば bb_then、そうでなければ bb_else に飛ぶ。
+// 次に出力するブロックへは飛ばずに落ちる
+static void codegen_branch(char *op, char *inv_op, int a, int b, IR *ir,
+                           BB *next) {
+  if (ir->bb_then == next) {
+    codegen_branch_to(inv_op, a, b, ir->bb_else);
     return;
+  }
 
-  case ND_COND: {
-    // -> t0
-    codegen_expr(node->lhs);
-    codegen_pop_t0();
-
-    printf("  beqz t0, .Lelse%03d\n", node->label_index);
+  codegen_branch_to(op, a, b, ir->bb_then);
+  if (ir->bb_else != next) {
+    emit_jump(ir->bb_else);
+  }
+}
 
-    printf("  # if {\n");
-    codegen_expr(node->rhs);
-    printf("  j .Lend%03d\n", node->label_index);
-    printf("  # if }\n");
+static char *binop_inst(IRKind kind) {
+  switch (kind) {
+  case IR_ADD:
+    return "add";
+  case IR_SUB:
+    return "sub";
+  case IR_MUL:
+    return "mul";
+  case IR_DIV:
+    return "div";
+  case IR_LT:
+  case IR_GE:
+    return "slt";
+  case IR_EQ:
+  case IR_NE:
+    return "xor";
+  case IR_AND:
+    return "and";
+  case IR_OR:
+    return "or";
+  }
 
-    printf("  # else {\n");
-    printf(".Lelse%03d:\n", node->label_index);
-    codegen_expr(node->node3);
-    printf("  # else }\n");
+  error("not a binary operator: %s", ir_kind_to_str(kind));
+}
 
-    printf(".Lend%03d:\n", node->label_index);
-    return;
+static char *shift_inst(IRKind kind) {
+  switch (kind) {
+  case IR_SLLI:
+    return "slli";
+  case IR_SRAI:
+    return "srai";
+  case IR_SRLI:
+    return "srli";
   }
 
-  case ND_CALL: {
-    // FIXME: __builtin_va_start に #define してからよびたい
-    if (node->ident->len == 8 &&
-        strncmp("va_start", node->ident->str, node->ident->len) == 0) {
-      // 最初の引数 ap だけ渡す。一般化できるといいけどとりあえず。
-      codegen_builtin_va_start(node->nodes->data[0]);
-      codegen_push_t0();
-      return;
-    }
-
-    int arg_count = 0;
-    for (int i = 0; i < node->nodes->len; i++) {
-      codegen_expr(node->nodes->data[i]);
-      arg_count++;
-    }
+  error("not a shift: %s", ir_kind_to_str(kind));
+}
 
-    while (arg_count > 0) {
-      codegen_pop_t0();
-      printf("  mv a%d, t0\n", --arg_count);
-    }
+static char *vec_binop_inst(IRKind kind) {
+  switch (kind) {
+  case IR_VADD:
+    return "vadd";
+  case IR_VSUB:
+    return "vsub";
+  case IR_VRSUB:
+    return "vrsub";
+  case IR_VMUL:
+    return "vmul";
+  }
 
-    // これいるか？？ sp はどういう状態で引き渡せばいいんだ
-    printf("  addi sp, sp, -8\n");
-    printf("  call %.*s\n", node->ident->len, node->ident->str);
-    printf("  addi sp, sp, 8\n");
+  error("not a vector binary operator: %s", ir_kind_to_str(kind));
+}
 
-    // 結果は a0 に入っているよな
-    printf("  # push return value (a0) {{{\n");
-    printf("  sd a0, -8(sp)\n");
-    printf("  addi sp, sp, -8\n");
-    printf("  # }}}\n");
+static void codegen_ir(IR *ir, BB *next) {
+  switch (ir->kind) {
+  case IR_IMM: {
+    int d = codegen_dst(ir->d);
+    emit_li(d, ir->imm);
+    codegen_def(ir->d, d);
     return;
   }
 
-  case ND_DEREF: {
-    codegen_expr(node->lhs);
-
-    if (typeof_node(node)->ty == TY_ARRAY) {
-      // deref した結果が配列の場合はさらにポインタとしてあつかうので
-      // push されたアドレスをそのまま返す
-      // ややこしすぎでは。なんか別の箇所にまとめられそう
+  case IR_MOV: {
+    int a = codegen_use(ir->a, REG_T5);
+    if (ir->d->rn < 0) {
+      codegen_def(ir->d, a);
       return;
     }
+    codegen_move(ir->d->rn, a, 8);
+    return;
+  }
 
-    Type *type = typeof_node(node->lhs);
-    int size = sizeof_type(type->base);
-
-    codegen_pop_t0();
-
-    printf("  # deref to get (%s)\n", type_to_string(type->base));
-    switch (size) {
-    case 1:
-      printf("  lb t0, 0(t0)\n");
-      break;
-    case 4:
-      printf("  lw t0, 0(t0)\n");
-      break;
-    case 8:
-      printf("  ld t0, 0(t0)\n");
-      break;
-
-    default:
-      error("unknown size of deref: (%s)",
-            type_to_string(typeof_node(node->lhs)));
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_LT:
+  case IR_GE:
+  case IR_EQ:
+  case IR_NE:
+  case IR_AND:
+  case IR_OR: {
+    int a = codegen_use(ir->a, REG_T5);
+    int b = codegen_use(ir->b, REG_T6);
+    int d = codegen_dst(ir->d);
+    emit_rrr(binop_inst(ir->kind), d, a, b);
+    if (ir->kind == IR_GE) {
+      emit_rri("xori", d, d, 1);
+    } else if (ir->kind == IR_EQ) {
+      emit_rr("seqz", d, d);
+    } else if (ir->kind == IR_NE) {
+      emit_rr("snez", d, d);
     }
-    codegen_push_t0();
-
+    codegen_def(ir->d, d);
     return;
   }
 
-  case ND_ADDR:
-    codegen_push_lvalue(node->lhs);
-
+  case IR_ADDI: {
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    codegen_addi(d, a, ir->imm);
+    codegen_def(ir->d, d);
     return;
+  }
 
-  case ND_GVAR:
-    if (node->gvar->type->ty == TY_ARRAY) {
-      // lvar と同様なんだけどこれこんなにあちこちでやるもんなのか？
-      printf("  lui t0, %%hi(%.*s)\n", node->gvar->len, node->gvar->name);
-      printf("  addi t0, t0, %%lo(%.*s)\n", node->gvar->len, node->gvar->name);
-    } else {
-      printf("  lui t0, %%hi(%.*s)\n", node->gvar->len, node->gvar->name);
-      printf("  lw t0, %%lo(%.*s)(t0)\n", node->gvar->len, node->gvar->name);
-    }
-    codegen_push_t0();
-
+  case IR_SLLI:
+  case IR_SRAI:
+  case IR_SRLI: {
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    emit_rri(shift_inst(ir->kind), d, a, ir->imm);
+    codegen_def(ir->d, d);
     return;
+  }
 
-  case ND_STRING:
-    printf("  lui t0, %%hi(.LC%d)\n", node->val);
-    printf("  addi t0, t0, %%lo(.LC%d)\n", node->val);
-    codegen_push_t0();
+  case IR_NOT: {
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    emit_rr("seqz", d, a);
+    codegen_def(ir->d, d);
+    return;
+  }
 
+  case IR_BOOL: {
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    emit_rr("snez", d, a);
+    codegen_def(ir->d, d);
     return;
+  }
 
-  case ND_MEMBER: {
-    Type *type = typeof_node(node->lhs);
-    if (type->ty != TY_STRUCT) {
-      error("not a struct: (%s)", type_to_string(type));
-    }
+  case IR_SEXT: {
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    codegen_move(d, a, ir->size);
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    Var *member = find_var(type->members, node->ident->str, node->ident->len);
-    if (member == NULL) {
-      error("member not found: %.*s on (%s)", node->ident->len,
-            node->ident->str, type_to_string(type));
+  case IR_LOAD: {
+    int d = codegen_dst(ir->d);
+    if (ir->gvar != NULL) {
+      char *sym = symbol(ir->gvar, ir->imm);
+      emit_sym(INST_LUI, "lui", d, -1, sym);
+      emit_sym(INST_LOAD_LO, load_op(ir->size), d, d, sym);
+    } else {
+      int offset;
+      int base = codegen_mem_base(ir, &offset);
+      codegen_mem(load_op(ir->size), d, base, offset);
     }
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    codegen_push_lvalue(node->lhs);
-    codegen_pop_t0();
-    printf("  # address for member '%.*s'\n", member->len, member->name);
-
-    // TODO: ND_LVAR とだいぶ似てる
-    if (member->type->ty == TY_ARRAY) {
-      printf("  addi t0, t0, %d\n", member->offset);
+  case IR_STORE: {
+    int val = codegen_use(ir->b, REG_T5);
+    if (ir->gvar != NULL) {
+      char *sym = symbol(ir->gvar, ir->imm);
+      emit_sym(INST_LUI, "lui", REG_T6, -1, sym);
+      emit_sym(INST_STORE_LO, store_op(ir->size), val, REG_T6, sym);
     } else {
-      int size = sizeof_type(member->type);
-
-      switch (size) {
-      case 1:
-        printf("  lb t0, %d(t0)\n", member->offset);
-        break;
-      case 4:
-        printf("  lw t0, %d(t0)\n", member->offset);
-        break;
-      case 8:
-        printf("  ld t0, %d(t0)\n", member->offset);
-        break;
-
-      default:
-        error("unknown size of member: (%s)", type_to_string(member->type));
-      }
+      int offset;
+      int base = codegen_mem_base(ir, &offset);
+      codegen_mem(store_op(ir->size), val, base, offset);
     }
-
-    codegen_push_t0();
-
     return;
   }
 
-  case ND_NOT:
-    codegen_expr(node->lhs);
-    codegen_pop_t0();
-    printf("  seqz t0, t0\n");
-    codegen_push_t0();
-
+  case IR_LADDR: {
+    int d = codegen_dst(ir->d);
+    codegen_addi(d, REG_FP, 0 - ir->lvar->offset + ir->imm);
+    codegen_def(ir->d, d);
     return;
+  }
 
-  case ND_POSTINC:
-    codegen_push_lvalue(node->lhs);
-    codegen_pop_t1();
+  case IR_GADDR: {
+    int d = codegen_dst(ir->d);
+    char *sym = symbol(ir->gvar, ir->imm);
+    emit_sym(INST_LUI, "lui", d, -1, sym);
+    emit_sym(INST_ADDI_LO, "addi", d, d, sym);
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    // FIXME ND_LVAR といっしょ！
-    switch (sizeof_type(typeof_node(node->lhs))) {
-    case 1:
-      printf("  lb t0, 0(t1)\n");
-      break;
-    case 4:
-      printf("  lw t0, 0(t1)\n");
-      break;
-    case 8:
-      printf("  ld t0, 0(t1)\n");
-      break;
-    default:
-      error("unknown size of lvar: (%s)",
-            type_to_string(typeof_node(node->lhs)));
-    }
+  case IR_SADDR: {
+    int d = codegen_dst(ir->d);
+    char *sym = arena_calloc(codegen_arena, 16, 1);
+    snprintf(sym, 16, ".LC%d", ir->imm);
+    emit_sym(INST_LUI, "lui", d, -1, sym);
+    emit_sym(INST_ADDI_LO, "addi", d, d, sym);
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    printf("  addi t2, t0, %d\n", node->val);
+  case IR_VASTART: {
+    int d = codegen_dst(ir->d);
+    emit_text("  # va_start");
+    emit_rri("addi", d, REG_FP, ir->imm * 8);
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    switch (sizeof_type(typeof_node(node->lhs))) {
-    case 1:
-      printf("  sb t2, 0(t1)\n");
-      break;
-    case 4:
-      printf("  sw t2, 0(t1)\n");
-      break;
-    case 8:
-      printf("  sd t2, 0(t1)\n");
-      break;
-    default:
-      error("unknown size of lvar: (%s)",
-            type_to_string(typeof_node(node->lhs)));
+  case IR_VSETVL: {
+    // a がなければ要素数をとれるだけとる
+    int a = 0;
+    if (ir->a != NULL) {
+      a = codegen_use(ir->a, REG_T5);
     }
-
-    codegen_push_t0();
-
+    int d = codegen_dst(ir->d);
+    emit_vec(d, a, -1, "  vsetvli %s, %s, e%d, m%d, tu, mu", reg_name(d),
+             reg_name(a), ir->size * 8, VEC_LMUL);
+    codegen_def(ir->d, d);
     return;
+  }
 
-  case ND_COMMA:
-    codegen_expr(node->lhs);
-    codegen_pop_discard();
-    codegen_expr(node->rhs);
+  case IR_VLOAD: {
+    int a = codegen_use(ir->a, REG_T5);
+    emit_vec(-1, a, -1, "  vle%d.v v%d, (%s)", ir->size * 8, ir->vd,
+             reg_name(a));
     return;
+  }
 
-  case ND_RETURN:
-  case ND_IF:
-  case ND_SWITCH:
-  case ND_WHILE:
-  case ND_FOR:
-  case ND_BLOCK:
-  case ND_FUNCDECL:
-  case ND_VARDECL:
-  case ND_GVARDECL:
-  case ND_BREAK:
-  case ND_CONTINUE:
-  case ND_CASE:
-  case ND_DEFAULT:
-  case ND_VARARGS:
-    break;
-
-  case ND_NOP:
+  case IR_VSTORE: {
+    int a = codegen_use(ir->a, REG_T5);
+    emit_vec(-1, a, -1, "  vse%d.v v%d, (%s)", ir->size * 8, ir->va,
+             reg_name(a));
     return;
   }
 
-  error_at(node->source_pos, "not an expression: %s",
-           node_kind_to_str(node->kind));
-}
-
-static void codegen_preamble() {
-  printf("  .section .rodata\n");
-  for (int i = 0; i < strings->len; i++) {
-    String *str = strings->data[i];
-    printf(".LC%d:\n", i);
-    printf("  .string \"%.*s\"\n", str->len, str->str);
+  case IR_VSPLAT: {
+    int b = codegen_use(ir->b, REG_T6);
+    emit_vec(-1, b, -1, "  vmv.v.x v%d, %s", ir->vd, reg_name(b));
+    return;
   }
 
-  printf("\n");
-  printf("  .global main\n");
-}
-
-static void codegen_builtin_va_start(Node *ap) {
-  int varargs_index = curr_varargs_index();
-  if (varargs_index == -1) {
-    error("va_start must be called in a function with varargs");
-  }
-
-  printf("  # va_start\n");
-  printf("  addi t0, fp, %d\n", varargs_index * 8);
-  codegen_push_t0();
-  codegen_push_lvalue(ap);
-  codegen_pop_t0();
-  codegen_pop_t1();
-  printf("  sd t1, 0(t0)\n");
-}
-
-static void codegen_init_struct_var(Node *node_var, Type *type, List *inits) {
-  int i;
-  for (i = 0; i < inits->len; i++) {
-    Var *member = type->members->data[i];
-
-    Node *node = inits->data[i];
-
-    Node *mem = new_node(ND_MEMBER, node_var, NULL);
-    mem->ident = calloc(1, sizeof(Token));
-    mem->ident->str = member->name;
-    mem->ident->len = member->len;
-
-    Node *assign = new_node(ND_ASSIGN, mem, node);
-    codegen_expr(assign);
-    codegen_pop_discard();
-  }
-
-  for (; i < type->members->len; i++) {
-    Var *member = type->members->data[i];
-
-    // ここで初期化されていないメンバーは 0 で初期化する
-    Node *node_mem = new_node(ND_MEMBER, node_var, NULL);
-    node_mem->ident = calloc(1, sizeof(Token));
-    node_mem->ident->str = member->name;
-    node_mem->ident->len = member->len;
-
-    Node *assign = new_node(ND_ASSIGN, node_mem, new_node(ND_NUM, NULL, NULL));
-    codegen_expr(assign);
-    codegen_pop_discard();
-  }
-}
-
-static bool codegen_node(Node *node) {
-  switch (node->kind) {
-  case ND_NUM:
-  case ND_LT:
-  case ND_GE:
-  case ND_ADD:
-  case ND_SUB:
-  case ND_MUL:
-  case ND_DIV:
-  case ND_EQ:
-  case ND_NE:
-  case ND_LOGOR:
-  case ND_LOGAND:
-  case ND_LVAR:
-  case ND_ASSIGN:
-  case ND_COND:
-  case ND_CALL:
-  case ND_DEREF:
-  case ND_ADDR:
-  case ND_GVAR:
-  case ND_STRING:
-  case ND_MEMBER:
-  case ND_NOT:
-  case ND_POSTINC:
-  case ND_COMMA:
-    codegen_expr(node);
-    return true;
-
-  case ND_RETURN:
-    if (node->lhs) {
-      codegen_expr(node->lhs);
-      codegen_pop_t0();
-      printf("  mv a0, t0\n");
+  case IR_VADD:
+  case IR_VSUB:
+  case IR_VRSUB:
+  case IR_VMUL: {
+    char *op = vec_binop_inst(ir->kind);
+    if (ir->b == NULL) {
+      emit_vec(-1, -1, -1, "  %s.vv v%d, v%d, v%d", op, ir->vd, ir->va,
+               ir->vb);
+      return;
     }
+    int b = codegen_use(ir->b, REG_T6);
+    emit_vec(-1, b, -1, "  %s.vx v%d, v%d, %s", op, ir->vd, ir->va,
+             reg_name(b));
+    return;
+  }
 
-    codegen_epilogue();
-
-    return false;
-
-  case ND_IF: {
-    printf("  # ND_IF {{{\n");
+  case IR_VREDSUM: {
+    // d = a + (va の要素の和)
+    int a = codegen_use(ir->a, REG_T5);
+    int d = codegen_dst(ir->d);
+    emit_vec(-1, a, -1, "  vmv.s.x v%d, %s", VEC_SCRATCH_REG, reg_name(a));
+    emit_vec(-1, -1, -1, "  vredsum.vs v%d, v%d, v%d", VEC_SCRATCH_REG,
+             ir->va, VEC_SCRATCH_REG);
+    emit_vec(d, -1, -1, "  vmv.x.s %s, v%d", reg_name(d), VEC_SCRATCH_REG);
+    codegen_def(ir->d, d);
+    return;
+  }
 
-    codegen_expr(node->lhs);
-    codegen_pop_t0();
+  case IR_PARAM:
+    // codegen_params で処理済み
+    return;
 
-    printf("  beqz t0, .Lelse%03d\n", node->label_index);
+  case IR_CALL:
+    codegen_call(ir);
+    return;
 
-    printf("  # if {\n");
-    if (codegen_node(node->rhs))
-      codegen_pop_discard();
-    printf("  j .Lend%03d\n", node->label_index);
-    printf("  # if }\n");
+  case IR_TAILCALL:
+    codegen_tail_call(ir);
+    return;
 
-    printf("  # else {\n");
-    printf(".Lelse%03d:\n", node->label_index);
-    if (node->node3) {
-      if (codegen_node(node->node3))
-        codegen_pop_discard();
+  case IR_JMP:
+    if (ir->bb_then != next) {
+      emit_jump(ir->bb_then);
     }
-    printf("  # else }\n");
-
-    printf(".Lend%03d:\n", node->label_index);
+    return;
 
-    printf("  # ND_IF }}}\n");
-    printf("\n");
+  case IR_BR: {
+    int a = codegen_use(ir->a, REG_T5);
+    codegen_branch("bnez", "beqz", a, -1, ir, next);
+    return;
+  }
 
-    return false;
+  case IR_BEQ:
+  case IR_BNE:
+  case IR_BLT:
+  case IR_BGE: {
+    int a = codegen_use(ir->a, REG_T5);
+    int b = codegen_use(ir->b, REG_T6);
+    if (ir->kind == IR_BEQ) {
+      codegen_branch("beq", "bne", a, b, ir, next);
+    } else if (ir->kind == IR_BNE) {
+      codegen_branch("bne", "beq", a, b, ir, next);
+    } else if (ir->kind == IR_BLT) {
+      codegen_branch("blt", "bge", a, b, ir, next);
+    } else {
+      codegen_branch("bge", "blt", a, b, ir, next);
+    }
+    return;
   }
 
-  case ND_SWITCH: {
-    codegen_expr(node->lhs);
-    codegen_pop_t0();
+  case IR_SWITCH: {
+    // a - imm が表の範囲にあれば .LJT<n> から飛び先を引いて飛ぶ
+    int a = codegen_use(ir->a, REG_T5);
+    // imm が INT_MIN のときは符号を反転できないので、li して引く
+    if (is_imm12(ir->imm) && is_imm12(0 - ir->imm)) {
+      emit_rri("addi", REG_T5, a, 0 - ir->imm);
+    } else {
+      emit_li(REG_T6, ir->imm);
+      emit_rrr("sub", REG_T5, a, REG_T6);
+    }
+    emit_li(REG_T6, ir->targets->len);
+    codegen_branch_to("bgeu", REG_T5, REG_T6, ir->bb_else);
+
+    char *sym = arena_calloc(codegen_arena, 16, 1);
+    snprintf(sym, 16, ".LJT%d", num_jump_tables + jump_tables->len);
+    list_append(jump_tables, ir);
+    emit_rri("slli", REG_T5, REG_T5, 3);
+    emit_sym(INST_LUI, "lui", REG_T6, -1, sym);
+    emit_sym(INST_ADDI_LO, "addi", REG_T6, REG_T6, sym);
+    emit_rrr("add", REG_T5, REG_T5, REG_T6);
+    emit_mem("ld", REG_T5, REG_T5, 0);
+    emit(INST_JUMP_REG, "jr", -1, REG_T5, -1, 0);
+    return;
+  }
 
-    // FIXME 直下が ND_BLOCK である前提だしネストしてたらうまくいかない
-    Node *node_default = NULL;
-    for (int i = 0; i < node->rhs->nodes->len; i++) {
-      Node *stmt = node->rhs->nodes->data[i];
-      if (stmt->kind == ND_CASE) {
-        printf("  li t1, %d\n", stmt->val);
-        printf("  beq t0, t1, .Lcase%03d\n", stmt->label_index);
-      } else if (stmt->kind == ND_DEFAULT) {
-        node_default = stmt;
-      }
+  case IR_RET:
+    if (ir->a != NULL) {
+      int a = codegen_use(ir->a, REG_T5);
+      codegen_move(REG_A0, a, 8);
     }
-    if (node_default) {
-      printf("  j .Ldefault%03d\n", node_default->label_index);
+    if (!frame_ready || is_frameless()) {
+      emit(INST_RET, "ret", -1, -1, -1, 0);
+      return;
     }
-
-    printf("  j .Lbreak%03d\n", node->label_index);
-    codegen_node(node->rhs);
-    printf(".Lbreak%03d:\n", node->label_index);
-
-    return false;
+    // 最後のブロックならそのままエピローグに落ちる
+    if (next != NULL) {
+      emit(INST_JUMP, "j", -1, -1, -1, epilogue_label);
+    }
+    epilogue_used = true;
+    return;
   }
 
-  case ND_WHILE: {
-    printf(".Lbegin%03d:\n", node->label_index);
-    printf(".Lcontinue%03d:\n", node->label_index);
+  error("codegen not implemented: %s", ir_kind_to_str(ir->kind));
+}
 
-    codegen_expr(node->lhs);
-    codegen_pop_t0();
+static void print_inst(Inst *inst) {
+  switch (inst->kind) {
+  case INST_RRR:
+    printf("  %s %s, %s, %s\n", inst->op, reg_name(inst->rd),
+           reg_name(inst->rs1), reg_name(inst->rs2));
+    return;
+  case INST_RRI:
+    printf("  %s %s, %s, %d\n", inst->op, reg_name(inst->rd),
+           reg_name(inst->rs1), inst->imm);
+    return;
+  case INST_RR:
+    printf("  %s %s, %s\n", inst->op, reg_name(inst->rd), reg_name(inst->rs1));
+    return;
+  case INST_LI:
+    printf("  li %s, %d\n", reg_name(inst->rd), inst->imm);
+    return;
+  case INST_LOAD:
+    printf("  %s %s, %d(%s)\n", inst->op, reg_name(inst->rd), inst->imm,
+           reg_name(inst->rs1));
+    return;
+  case INST_STORE:
+    printf("  %s %s, %d(%s)\n", inst->op, reg_name(inst->rs2), inst->imm,
+           reg_name(inst->rs1));
+    return;
+  case INST_LUI:
+    printf("  lui %s, %%hi(%s)\n", reg_name(inst->rd), inst->sym);
+    return;
+  case INST_ADDI_LO:
+    printf("  addi %s, %s, %%lo(%s)\n", reg_name(inst->rd),
+           reg_name(inst->rs1), inst->sym);
+    return;
+  case INST_LOAD_LO:
+    printf("  %s %s, %%lo(%s)(%s)\n", inst->op, reg_name(inst->rd), inst->sym,
+           reg_name(inst->rs1));
+    return;
+  case INST_STORE_LO:
+    printf("  %s %s, %%lo(%s)(%s)\n", inst->op, reg_name(inst->rs2),
+           inst->sym, reg_name(inst->rs1));
+    return;
+  case INST_BRANCH:
+    if (inst->rs2 == -1) {
+      printf("  %s %s, .Lbb%03d\n", inst->op, reg_name(inst->rs1), inst->imm);
+    } else {
+      printf("  %s %s, %s, .Lbb%03d\n", inst->op, reg_name(inst->rs1),
+             reg_name(inst->rs2), inst->imm);
+    }
+    return;
+  case INST_JUMP:
+    printf("  j .Lbb%03d\n", inst->imm);
+    return;
+  case INST_JUMP_REG:
+    printf("  jr %s\n", reg_name(inst->rs1));
+    return;
+  case INST_CALL:
+    printf("  call %s\n", inst->sym);
+    return;
+  case INST_RET:
+    printf("  ret\n");
+    return;
+  case INST_TAIL:
+    printf("  tail %s\n", inst->sym);
+    return;
+  case INST_LABEL:
+    printf(".Lbb%03d:\n", inst->imm);
+    return;
+  case INST_TEXT:
+  case INST_VEC:
+    printf("%s\n", inst->sym);
+    return;
+  case INST_NOP:
+    return;
+  }
+}
 
-    printf("  beqz t0, .Lend%03d\n", node->label_index);
+static bool reg_needs_frame(Reg *reg) {
+  if (reg == NULL) {
+    return false;
+  }
+  return reg->rn < 0 || is_saved_reg(reg->rn);
+}
 
-    if (codegen_node(node->rhs))
-      codegen_pop_discard();
+// ブロックがフレームを使うか。ra や s レジスタを保存してから実行するもの
+static bool bb_needs_frame(BB *bb) {
+  for (int i = 0; i < bb->irs->len; i++) {
+    IR *ir = bb->irs->data[i];
+    if (ir->kind == IR_CALL || ir->kind == IR_VASTART || ir->lvar != NULL) {
+      return true;
+    }
+    if (reg_needs_frame(ir->d) || reg_needs_frame(ir->a) ||
+        reg_needs_frame(ir->b)) {
+      return true;
+    }
+    if (ir->kind == IR_TAILCALL) {
+      for (int j = 0; j < ir->args->len; j++) {
+        if (reg_needs_frame(ir->args->data[j])) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
 
-    printf("  j .Lbegin%03d\n", node->label_index);
+static int bb_index(IRFunc *fn, BB *bb) {
+  for (int i = 0; i < fn->bbs->len; i++) {
+    if (fn->bbs->data[i] == bb) {
+      return i;
+    }
+  }
+  error("unknown basic block: %d", bb->label);
+  return -1;
+}
 
-    printf(".Lbreak%03d:\n", node->label_index);
-    printf(".Lend%03d:\n", node->label_index);
+// プロローグを置くブロックを決める。先頭からフレームを使わないブロック
+// だけでたどれる範囲を「前」とし、前から出る辺がすべて同じブロック P に
+// 入り、後ろから前や P に戻る辺がなければ、プロローグを P の頭に置く。
+// こうすると P より後ろの return だけがエピローグを通る
+static void shrink_wrap(IRFunc *fn) {
+  int n = fn->bbs->len;
+  prologue_bb = NULL;
+  before_prologue = arena_calloc(codegen_arena, n, 1);
+  if (use_fp || is_frameless()) {
+    return;
+  }
 
-    return false;
+  char *needs = arena_calloc(codegen_arena, n, 1);
+  for (int i = 0; i < n; i++) {
+    needs[i] = bb_needs_frame(fn->bbs->data[i]);
+  }
+  if (needs[0]) {
+    return;
   }
 
-  case ND_FOR: {
-    if (node->lhs) {
-      if (codegen_node(node->lhs))
-        codegen_pop_discard();
+  char *before = arena_calloc(codegen_arena, n, 1);
+  before[0] = 1;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < n; i++) {
+      if (!before[i]) {
+        continue;
+      }
+      BB *bb = fn->bbs->data[i];
+      for (int j = 0; j < ir_num_succs(bb); j++) {
+        int s = bb_index(fn, ir_succ(bb, j));
+        if (!before[s] && !needs[s]) {
+          before[s] = 1;
+          changed = true;
+        }
+      }
     }
+  }
 
-    printf(".Lbegin%03d:\n", node->label_index);
-
-    if (node->rhs) {
-      codegen_expr(node->rhs);
-      codegen_pop_t0();
-      printf("  beqz t0, .Lend%03d\n", node->label_index);
+  BB *target = NULL;
+  for (int i = 0; i < n; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      BB *succ = ir_succ(bb, j);
+      int s = bb_index(fn, succ);
+      if (before[i]) {
+        if (!before[s]) {
+          if (target != NULL && target != succ) {
+            return;
+          }
+          target = succ;
+        }
+      } else if (before[s]) {
+        return;
+      }
     }
+  }
+  if (target == NULL) {
+    return;
+  }
 
-    if (node->node4) {
-      if (codegen_node(node->node4)) // { ... }
-        codegen_pop_discard();
+  // P にはプロローグより前からしか入れない
+  for (int i = 0; i < n; i++) {
+    BB *bb = fn->bbs->data[i];
+    if (before[i]) {
+      continue;
+    }
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      if (ir_succ(bb, j) == target) {
+        return;
+      }
     }
+  }
 
-    printf(".Lcontinue%03d:\n", node->label_index);
+  prologue_bb = target;
+  before_prologue = before;
+}
 
-    // i++ みたいなとこ
-    if (node->node3) {
-      codegen_expr(node->node3);
-      codegen_pop_discard();
+static bool is_frame_var(List *frame_vars, Var *var) {
+  for (int i = 0; i < frame_vars->len; i++) {
+    if (frame_vars->data[i] == var) {
+      return true;
     }
+  }
+  return false;
+}
 
-    printf("j .Lbegin%03d\n", node->label_index);
-
-    printf(".Lbreak%03d:\n", node->label_index);
-    printf(".Lend%03d:\n", node->label_index);
+static int roundup_to_16(int size) {
+  return (size + 15) / 16 * 16;
+}
 
-    return false;
+static void codegen_func(Node *node) {
+  IRFunc *fn = gen_ir(node);
+  eliminate_common_subexprs(fn);
+  optimize_loops(fn);
+  reduce_strength(fn);
+  eliminate_dead_code(fn);
+  if (opt_dump_ir) {
+    ir_dump(fn);
   }
-
-  case ND_BLOCK:
-    // scope の対応がいるかもね
-    for (int i = 0; i < node->nodes->len; i++) {
-      if (codegen_node(node->nodes->data[i]))
-        codegen_pop_discard();
+  regalloc(fn);
+  codegen_fn = fn;
+
+  // レジスタに置いた変数と、命令から参照されない変数にはフレームの場所を
+  // とらないので、メモリに置くものだけで詰めなおす
+  List *frame_vars = list_new(); // of Var *
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->lvar != NULL && !is_frame_var(frame_vars, ir->lvar)) {
+        list_append(frame_vars, ir->lvar);
+      }
     }
+  }
 
-    return false;
+  frame_locals_size = 0;
+  for (int i = 0; i < node->locals->len; i++) {
+    Var *var = node->locals->data[i];
+    if (var->reg == NULL && is_frame_var(frame_vars, var)) {
+      frame_locals_size += (sizeof_type(var->type) + 7) / 8 * 8;
+      var->offset = frame_locals_size;
+    }
+  }
 
-  case ND_FUNCDECL:
-    printf("\n");
-    printf("  .global %.*s\n", node->ident->len, node->ident->str);
-    printf("  .text\n");
-    printf("%.*s:\n", node->ident->len, node->ident->str);
+  int num_saved = 0;
+  for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+    if (fn->used_regs[rn] && is_saved_reg(rn)) {
+      num_saved++;
+    }
+  }
+  frame_size = roundup_to_16(frame_locals_size + fn->num_spill_slots * 8 +
+                             num_saved * 8);
+
+  use_fp = fn->varargs_index != -1;
+  has_call = false;
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind == IR_CALL) {
+        has_call = true;
+      }
+    }
+  }
 
-    curr_func = node;
+  printf("\n");
+  printf("  .global %.*s\n", node->ident->len, token_str(node->ident));
+  printf("  .text\n");
+  printf("%.*s:\n", node->ident->len, token_str(node->ident));
+
+  insts = list_new();
+  jump_tables = list_new();
+  shrink_wrap(fn);
+  epilogue_label = ++label_index;
+  epilogue_used = false;
+  frame_ready = prologue_bb == NULL;
+  if (frame_ready) {
     codegen_prologue();
+  }
 
-    for (int i = 0; i < node->args->len; i++) {
-      Node *arg = node->args->data[i];
-      if (arg->kind == ND_VARARGS) {
-        // これは vararg なのでオワリ
-        printf("  # vararg\n");
-        break;
-      }
-
-      // a0 を lvar xyz に代入するみたいなことをする
-      printf("  # assign to argument '%.*s'\n", arg->source_len,
-             arg->source_pos);
-      printf("  sd a%d, -%d(fp)\n", i, arg->lvar->offset);
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    BB *next = NULL;
+    if (i + 1 < fn->bbs->len) {
+      next = fn->bbs->data[i + 1];
     }
 
-    for (int i = 0; i < node->nodes->len; i++) {
-      Node *stmt = node->nodes->data[i];
-      if (codegen_node(stmt))
-        codegen_pop_t0();
+    int j = 0;
+    if (i == 0) {
+      j = codegen_params(bb);
+    } else {
+      emit(INST_LABEL, NULL, -1, -1, -1, bb->label);
     }
+    if (bb == prologue_bb) {
+      codegen_prologue();
+    }
+    frame_ready = !before_prologue[i];
+    for (; j < bb->irs->len; j++) {
+      codegen_ir(bb->irs->data[j], next);
+    }
+  }
 
-    printf("  mv a0, zero\n");
+  if (epilogue_used) {
+    emit(INST_LABEL, NULL, -1, -1, -1, epilogue_label);
     codegen_epilogue();
-    curr_func = NULL;
+  }
 
-    return false;
+  peephole(insts);
+  if (opt_schedule) {
+    schedule(insts);
+  }
+  for (int i = 0; i < insts->len; i++) {
+    print_inst(insts->data[i]);
+  }
 
-  case ND_VARDECL: {
-    printf("  # vardecl '%.*s' offset=%d size=%d\n", node->lvar->len,
-           node->lvar->name, node->lvar->offset, sizeof_type(node->lvar->type));
-
-    if (node->rhs) {
-      Node *lvar = calloc(1, sizeof(Node));
-      lvar->kind = ND_LVAR;
-      lvar->lvar = node->lvar;
-      Node *assign = new_node(ND_ASSIGN, lvar, node->rhs);
-      codegen_expr(assign);
-      codegen_pop_discard();
-    } else if (node->nodes) {
-      if (node->lvar->type->ty == TY_STRUCT) {
-        Node *lvar = calloc(1, sizeof(Node));
-        lvar->kind = ND_LVAR;
-        lvar->lvar = node->lvar;
-        codegen_init_struct_var(lvar, node->lvar->type, node->nodes);
-      } else {
-        error("not implemented for type (%s)", type_to_string(node->type));
-      }
+  for (int i = 0; i < jump_tables->len; i++) {
+    IR *ir = jump_tables->data[i];
+    printf("\n");
+    printf("  .section .rodata\n");
+    printf("  .align 3\n");
+    printf(".LJT%d:\n", num_jump_tables);
+    num_jump_tables++;
+    for (int j = 0; j < ir->targets->len; j++) {
+      BB *bb = ir->targets->data[j];
+      printf("  .dword .Lbb%03d\n", bb->label);
     }
+  }
 
-    return false;
+  codegen_fn = NULL;
+  arena_reset(codegen_arena);
+}
+
+static void codegen_data(int size, int val) {
+  switch (size) {
+  case 1:
+    printf("  .byte %d\n", val);
+    return;
+  case 4:
+    printf("  .word %d\n", val);
+    return;
+  case 8:
+    printf("  .dword %d\n", val);
+    return;
   }
 
-  case ND_GVARDECL: {
-    if (node->gvar->is_extern) {
-      printf("  # extern %.*s\n", node->gvar->len, node->gvar->name);
-      return false;
-    }
+  error("unsupported size for initializer: %d", size);
+}
 
-    printf("\n");
-    printf("  .global %.*s\n", node->gvar->len, node->gvar->name);
-    printf("  .data\n");
-    printf("%.*s:\n", node->gvar->len, node->gvar->name);
-    if (node->rhs != NULL) {
-      // TODO: 構造体はまだ
-      // TODO: ポインタの演算はまだ
-      // TODO: long だったら quad とからしい。dword?
-      printf("  .word %d\n", node->rhs->val);
-    } else if (node->nodes != NULL) {
-      if (node->gvar->type->ty == TY_ARRAY) {
-        int len = node->gvar->type->array_size;
-        for (int i = 0; i < node->nodes->len; i++) {
-          Node *init = node->nodes->data[i];
-          printf("  .word %d\n", init->val);
-          if (--len < 0) {
-            error("too many elements in array initializer");
-          }
-        }
-        while (len--) {
-          printf("  .zero %d\n", sizeof_type(node->gvar->type->base));
-        }
-      } else if (node->gvar->type->ty == TY_STRUCT) {
-        int i;
-        for (i = 0; i < node->nodes->len; i++) {
-          Var *member = node->gvar->type->members->data[i];
-          Node *init = node->nodes->data[i];
-          switch (sizeof_type(member->type)) {
-          case 1:
-            printf("  .byte %d\n", init->val);
-            break;
-          case 4:
-            printf("  .word %d\n", init->val);
-            break;
-          case 8:
-            printf("  .dword %d\n", init->val);
-            break;
-          default:
-            error("unsupported member type (%s)", type_to_string(member->type));
-          }
-        }
-        for (; i < node->gvar->type->members->len; i++) {
-          Var *member = node->gvar->type->members->data[i];
-          switch (sizeof_type(member->type)) {
-          case 1:
-            printf("  .byte 0\n");
-            break;
-          case 4:
-            printf("  .word 0\n");
-            break;
-          case 8:
-            printf("  .dword 0\n");
-            break;
-          default:
-            error("unsupported member type (%s)", type_to_string(member->type));
-          }
+static void codegen_gvar(Node *node) {
+  if (node->gvar->is_extern) {
+    printf("  # extern %.*s\n", node->gvar->len, node->gvar->name);
+    return;
+  }
+
+  printf("\n");
+  printf("  .global %.*s\n", node->gvar->len, node->gvar->name);
+  printf("  .data\n");
+  printf("%.*s:\n", node->gvar->len, node->gvar->name);
+  if (node->rhs != NULL) {
+    // TODO: 構造体はまだ
+    // TODO: ポインタの演算はまだ
+    codegen_data(sizeof_type(node->gvar->type), node->rhs->val);
+  } else if (node->nodes != NULL) {
+    if (node->gvar->type->ty == TY_ARRAY) {
+      int elem_size = sizeof_type(node->gvar->type->base);
+      int len = node->gvar->type->array_size;
+      for (int i = 0; i < node->nodes->len; i++) {
+        Node *init = node->nodes->data[i];
+        codegen_data(elem_size, init->val);
+        if (--len < 0) {
+          error("too many elements in array initializer");
         }
-      } else {
-        error("global initializer not supported for type (%s)",
-              type_to_string(node->gvar->type));
+      }
+      while (len--) {
+        printf("  .zero %d\n", elem_size);
+      }
+    } else if (node->gvar->type->ty == TY_STRUCT) {
+      int i;
+      for (i = 0; i < node->nodes->len; i++) {
+        Var *member = node->gvar->type->members->data[i];
+        Node *init = node->nodes->data[i];
+        codegen_data(sizeof_type(member->type), init->val);
+      }
+      for (; i < node->gvar->type->members->len; i++) {
+        Var *member = node->gvar->type->members->data[i];
+        codegen_data(sizeof_type(member->type), 0);
       }
     } else {
-      printf("  .zero %d\n", sizeof_type(node->gvar->type));
+      error("global initializer not supported for type (%s)",
+            type_to_string(node->gvar->type));
     }
-    return false;
+  } else {
+    printf("  .zero %d\n", sizeof_type(node->gvar->type));
   }
+}
 
-  case ND_BREAK:
-    printf("  j .Lbreak%03d\n", node->label_index);
-    return false;
-
-  case ND_CONTINUE:
-    printf("  j .Lcontinue%03d\n", node->label_index);
-    return false;
-
-  case ND_CASE:
-    printf("  # case %d\n", node->val);
-    printf(".Lcase%03d:\n", node->label_index);
-    return false;
-
-  case ND_DEFAULT:
-    printf("  # case default\n");
-    printf(".Ldefault%03d:\n", node->label_index);
-    return false;
-
-  case ND_VARARGS:
-  case ND_NOP:
-    return false;
+static void codegen_preamble() {
+  printf("  .section .rodata\n");
+  for (int i = 0; i < strings->len; i++) {
+    String *str = strings->data[i];
+    printf(".LC%d:\n", i);
+    printf("  .string \"%.*s\"\n", str->len, str->str);
   }
 
-  error_at(node->source_pos, "codegen not implemented: %s",
-           node_kind_to_str(node->kind));
+  printf("\n");
+  printf("  .global main\n");
 }
 
 void codegen() {
   codegen_preamble();
 
+  // インライン展開で呼び出し先の大きさを見るので、先に全部の関数を畳んでおく
   for (int i = 0; i < code->len; i++) {
-    if (codegen_node(code->data[i]))
-      codegen_pop_t0();
+    Node *node = code->data[i];
+    if (node->kind == ND_FUNCDECL) {
+      fold_consts(node);
+    }
+  }
+
+  for (int i = 0; i < code->len; i++) {
+    Node *node = code->data[i];
+    if (node->kind == ND_FUNCDECL) {
+      codegen_func(node);
+    } else if (node->kind == ND_GVARDECL) {
+      codegen_gvar(node);
+    }
   }
 }
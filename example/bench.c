@@ -0,0 +1,174 @@
+// 最適化の効果を見るためのベンチマーク
+//
+// ライフゲーム、switch で分岐する小さなインタプリタ、再帰、末尾呼び出し、
+// 定数での割り算、配列の総和をそれぞれ回して結果を表示する。
+// 結果は最適化によって変わってはいけない。make bench で実行した命令数を数える
+
+int printf(char *fmt, ...);
+
+int grid[20][20];
+int nbr[20][20];
+
+int count_nbr(int i, int j, int size) {
+  int n_count = 0;
+  if (i - 1 >= 0 && j - 1 >= 0) {
+    if (grid[i - 1][j - 1] >= 1)
+      n_count++;
+  }
+  if (i - 1 >= 0) {
+    if (grid[i - 1][j] >= 1)
+      n_count++;
+  }
+  if (i - 1 >= 0 && j + 1 < size) {
+    if (grid[i - 1][j + 1] >= 1)
+      n_count++;
+  }
+  if (j - 1 >= 0) {
+    if (grid[i][j - 1] >= 1)
+      n_count++;
+  }
+  if (j + 1 < size) {
+    if (grid[i][j + 1] >= 1)
+      n_count++;
+  }
+  if (i + 1 < size && j - 1 >= 0) {
+    if (grid[i + 1][j - 1] >= 1)
+      n_count++;
+  }
+  if (i + 1 < size) {
+    if (grid[i + 1][j] >= 1)
+      n_count++;
+  }
+  if (i + 1 < size && j + 1 < size) {
+    if (grid[i + 1][j + 1] >= 1)
+      n_count++;
+  }
+  return n_count;
+}
+
+int life() {
+  for (int i = 0; i < 20; i++) {
+    for (int j = 0; j < 20; j++) {
+      if (i == 7 && 5 <= j && j <= 16) {
+        grid[i][j] = 1;
+      } else {
+        grid[i][j] = 0;
+      }
+    }
+  }
+  int i;
+  int j;
+  int steps;
+  for (steps = 0; steps < 30; ++steps) {
+    for (i = 0; i < 20; ++i) {
+      for (j = 0; j < 20; ++j) {
+        nbr[i][j] = count_nbr(i, j, 20);
+      }
+    }
+    for (i = 0; i < 20; ++i) {
+      for (j = 0; j < 20; ++j) {
+        if (grid[i][j] >= 1) {
+          if (nbr[i][j] <= 1 || nbr[i][j] >= 4)
+            grid[i][j] = 0;
+        } else if (nbr[i][j] == 3)
+          grid[i][j] = 1;
+      }
+    }
+  }
+  int alive = 0;
+  for (i = 0; i < 20; i++)
+    for (j = 0; j < 20; j++)
+      alive += grid[i][j];
+  return alive;
+}
+
+int dispatch(int op, int acc) {
+  switch (op) {
+  case 0:
+    return acc + 1;
+  case 1:
+    return acc - 1;
+  case 2:
+    return acc * 2;
+  case 3:
+    return acc / 2;
+  case 4:
+    return acc + 3;
+  case 5:
+    return acc - 3;
+  case 6:
+    return acc + 7;
+  case 7:
+    return acc - 7;
+  case 8:
+    return acc + 11;
+  case 9:
+    return acc - 11;
+  case 10:
+    return acc + 13;
+  case 11:
+    return acc - 13;
+  case 12:
+    return acc + 17;
+  case 13:
+    return acc - 17;
+  case 14:
+    return acc + 19;
+  case 15:
+    return acc - 19;
+  }
+  return acc;
+}
+
+int interp() {
+  int acc = 0;
+  for (int i = 0; i < 5000; i++) {
+    acc = dispatch(i - i / 16 * 16, acc);
+  }
+  return acc;
+}
+
+int fib(int n) {
+  if (n < 2)
+    return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int sum_to(int n, int acc) {
+  if (n == 0)
+    return acc;
+  return sum_to(n - 1, acc + n);
+}
+
+int digits() {
+  int total = 0;
+  for (int i = 0; i < 3000; i++) {
+    int x = i * 37;
+    while (x > 0) {
+      total += x - x / 10 * 10;
+      x = x / 10;
+    }
+  }
+  return total;
+}
+
+int arr[1000];
+int vecsum() {
+  for (int i = 0; i < 1000; i++)
+    arr[i] = i * 3;
+  int s = 0;
+  for (int k = 0; k < 20; k++)
+    for (int i = 0; i < 1000; i++)
+      s += arr[i];
+  return s;
+}
+
+int main() {
+  printf("life=%d\n", life());
+  printf("interp=%d\n", interp());
+  printf("fib=%d\n", fib(18));
+  printf("sum_to=%d\n", sum_to(10000, 0));
+  printf("digits=%d\n", digits());
+  printf("vecsum=%d\n", vecsum());
+  return 0;
+}
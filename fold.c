@@ -0,0 +1,250 @@
+// 定数の畳みこみ
+//
+// gen_ir に渡す前の関数の AST で、オペランドがどちらも定数の式を計算して
+// ND_NUM にする。&&, || と ?: は、評価しない側を捨ててよいときだけ畳む。
+// 条件が定数の if は、通らない側の文を出力しないように取りのぞく。
+//
+// 定数で初期化したきり書きかえもアドレスをとりもしない int, char の
+// ローカル変数は、Var の const_val に値を覚えて、使うところを定数にする。
+// そうして定数になった式で初期化した変数も定数になるので、新しく見つから
+// なくなるまでくりかえす。
+//
+// switch の case は文の途中にも置けるので、case や default を含む文は
+// 取りのぞかない。
+
+#include "mocc.h"
+
+static List *fold_written; // of Var *, 書きかえるかアドレスをとる変数
+static List *fold_decls;   // of Node *, 定数で初期化する ND_VARDECL
+
+static bool fold_contains(List *list, void *data) {
+  for (int i = 0; i < list->len; i++) {
+    if (list->data[i] == data) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// node の中に case か default があるか
+static bool has_case_label(Node *node) {
+  if (node == NULL) {
+    return false;
+  }
+  if (node->kind == ND_CASE || node->kind == ND_DEFAULT) {
+    return true;
+  }
+  if (has_case_label(node->lhs) || has_case_label(node->rhs) ||
+      has_case_label(node->node3) || has_case_label(node->node4)) {
+    return true;
+  }
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      if (has_case_label(node->nodes->data[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static Node *fold_binop(Node *node) {
+  if (node->lhs->kind != ND_NUM || node->rhs->kind != ND_NUM) {
+    return node;
+  }
+
+  // あふれる計算は、実行時に addw などで切りつめられるようにそのまま残す
+  int l = node->lhs->val;
+  int r = node->rhs->val;
+  switch (node->kind) {
+  case ND_ADD:
+    if (add_overflows(l, r)) {
+      return node;
+    }
+    return new_node_num(l + r);
+  case ND_SUB:
+    if (sub_overflows(l, r)) {
+      return node;
+    }
+    return new_node_num(l - r);
+  case ND_MUL:
+    if (mul_overflows(l, r)) {
+      return node;
+    }
+    return new_node_num(l * r);
+  case ND_DIV:
+    // 0 で割るのと、-1 で割ってあふれるかもしれないのは実行時にまかせる
+    if (r == 0 || r == -1) {
+      return node;
+    }
+    return new_node_num(l / r);
+  case ND_EQ:
+    return new_node_num(l == r);
+  case ND_NE:
+    return new_node_num(l != r);
+  case ND_LT:
+    return new_node_num(l < r);
+  case ND_GE:
+    return new_node_num(l >= r);
+  }
+  return node;
+}
+
+// 条件が定数の if を、通る側の文にする
+static Node *fold_if(Node *node) {
+  Node *taken = node->rhs;
+  Node *dropped = node->node3;
+  if (node->lhs->val == 0) {
+    taken = node->node3;
+    dropped = node->rhs;
+  }
+  if (has_case_label(dropped)) {
+    return node;
+  }
+  if (taken == NULL) {
+    return new_node(ND_NOP, NULL, NULL);
+  }
+  return taken;
+}
+
+static Node *fold_node(Node *node) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  node->lhs = fold_node(node->lhs);
+  node->rhs = fold_node(node->rhs);
+  node->node3 = fold_node(node->node3);
+  node->node4 = fold_node(node->node4);
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      node->nodes->data[i] = fold_node(node->nodes->data[i]);
+    }
+  }
+
+  switch (node->kind) {
+  case ND_LVAR:
+    if (node->lvar->const_val != NULL) {
+      return new_node_num(node->lvar->const_val->val);
+    }
+    return node;
+
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_GE:
+    return fold_binop(node);
+
+  case ND_NOT:
+    if (node->lhs->kind == ND_NUM) {
+      return new_node_num(!node->lhs->val);
+    }
+    return node;
+
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    if (node->lhs->kind != ND_NUM) {
+      return node;
+    }
+    // 0 && x と 1 || x は x を評価しない
+    if (node->kind == ND_LOGAND && node->lhs->val == 0) {
+      return new_node_num(0);
+    }
+    if (node->kind == ND_LOGOR && node->lhs->val != 0) {
+      return new_node_num(1);
+    }
+    if (node->rhs->kind == ND_NUM) {
+      return new_node_num(node->rhs->val != 0);
+    }
+    return node;
+  }
+
+  case ND_COND:
+    if (node->lhs->kind != ND_NUM) {
+      return node;
+    }
+    if (node->lhs->val != 0) {
+      return node->rhs;
+    }
+    return node->node3;
+
+  case ND_IF:
+    if (node->lhs->kind != ND_NUM) {
+      return node;
+    }
+    return fold_if(node);
+  }
+  return node;
+}
+
+// 変数への書きこみと、定数での初期化を集める
+static void find_var_writes(Node *node) {
+  if (node == NULL) {
+    return;
+  }
+
+  if (node->kind == ND_ASSIGN || node->kind == ND_POSTINC ||
+      node->kind == ND_ADDR) {
+    if (node->lhs->kind == ND_LVAR) {
+      list_append(fold_written, node->lhs->lvar);
+    }
+  }
+  if (node->kind == ND_VARDECL) {
+    if (node->rhs != NULL && node->rhs->kind == ND_NUM) {
+      list_append(fold_decls, node);
+    } else {
+      list_append(fold_written, node->lvar);
+    }
+  }
+
+  find_var_writes(node->lhs);
+  find_var_writes(node->rhs);
+  find_var_writes(node->node3);
+  find_var_writes(node->node4);
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      find_var_writes(node->nodes->data[i]);
+    }
+  }
+}
+
+// 定数のまま使える変数か
+static bool is_const_var(Var *var, int val) {
+  if (var->const_val != NULL || fold_contains(fold_written, var)) {
+    return false;
+  }
+  if (var->type->ty == TY_CHAR) {
+    return -128 <= val && val <= 127;
+  }
+  return var->type->ty == TY_INT;
+}
+
+void fold_consts(Node *func) {
+  for (;;) {
+    for (int i = 0; i < func->nodes->len; i++) {
+      func->nodes->data[i] = fold_node(func->nodes->data[i]);
+    }
+
+    fold_written = list_new();
+    fold_decls = list_new();
+    for (int i = 0; i < func->nodes->len; i++) {
+      find_var_writes(func->nodes->data[i]);
+    }
+
+    bool found = false;
+    for (int i = 0; i < fold_decls->len; i++) {
+      Node *decl = fold_decls->data[i];
+      if (is_const_var(decl->lvar, decl->rhs->val)) {
+        decl->lvar->const_val = decl->rhs;
+        found = true;
+      }
+    }
+    if (!found) {
+      return;
+    }
+  }
+}
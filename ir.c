@@ -0,0 +1,2415 @@
+// 中間表現 (IR) の生成
+//
+// parse_program が作った関数の AST を、基本ブロックと仮想レジスタからなる
+// 三番地コードに変換する。ローカル変数のうちアドレスをとられないスカラーは
+// 仮想レジスタにそのまま置き、それ以外はフレーム上でロード・ストアする。
+// 小さい関数の呼び出しは、呼ばれる関数の本体をその場で生成して展開する。
+// 回数の決まった for ループは本体を複製して展開する。
+// -march=rv64gcv のときは、配列を要素ごとに処理するループをベクトル化する。
+// 関数を抜ける直前の呼び出しは、ループか IR_TAILCALL に置きかえる。
+
+#include "mocc.h"
+
+typedef struct JumpTarget JumpTarget;
+
+// break, continue の飛び先
+struct JumpTarget {
+  int label_index; // ND_WHILE, ND_FOR, ND_SWITCH の label_index
+  BB *bb_break;
+  BB *bb_continue;
+};
+
+typedef struct SwitchCase SwitchCase;
+
+// switch の case の値と飛び先
+struct SwitchCase {
+  int val;
+  BB *bb;
+};
+
+typedef struct Addr Addr;
+
+// 読み書きする場所。base + offset、またはフレーム上の lvar や
+// グローバル変数 gvar の先頭から offset のところ
+struct Addr {
+  Reg *base;
+  Var *lvar;
+  Var *gvar;
+  int offset;
+};
+
+static IRFunc *curr_fn;
+static BB *curr_bb;
+static List *jump_targets; // of JumpTarget *
+static List *case_bbs;     // of BB *, ND_CASE, ND_DEFAULT と同じラベル番号
+static List *inline_stack; // of Node *, 展開中の関数
+static Reg *inline_ret;    // 展開中の関数の返り値
+static BB *inline_end;     // 展開中の関数の return の飛び先
+
+char *ir_kind_to_str(IRKind kind) {
+  switch (kind) {
+#define IR_KIND(k)                                                             \
+  case k:                                                                      \
+    return #k;
+#include "ir_kind.def"
+#undef IR_KIND
+  }
+
+  return "(unknown)";
+}
+
+// a と b を比べて分岐する命令か
+bool ir_is_compare_branch(IR *ir) {
+  return ir->kind == IR_BEQ || ir->kind == IR_BNE || ir->kind == IR_BLT ||
+         ir->kind == IR_BGE;
+}
+
+bool ir_is_terminator(IR *ir) {
+  return ir->kind == IR_JMP || ir->kind == IR_BR || ir_is_compare_branch(ir) ||
+         ir->kind == IR_SWITCH || ir->kind == IR_RET ||
+         ir->kind == IR_TAILCALL;
+}
+
+static IR *ir_last(BB *bb) {
+  if (bb->irs->len == 0) {
+    return NULL;
+  }
+  return bb->irs->data[bb->irs->len - 1];
+}
+
+int ir_num_succs(BB *bb) {
+  IR *last = ir_last(bb);
+  switch (last->kind) {
+  case IR_JMP:
+    return 1;
+  case IR_BR:
+  case IR_BEQ:
+  case IR_BNE:
+  case IR_BLT:
+  case IR_BGE:
+    return 2;
+  case IR_SWITCH:
+    return last->targets->len + 1;
+  default:
+    return 0;
+  }
+}
+
+BB *ir_succ(BB *bb, int i) {
+  IR *last = ir_last(bb);
+  if (last->kind == IR_SWITCH) {
+    if (i < last->targets->len) {
+      return last->targets->data[i];
+    }
+    return last->bb_else;
+  }
+  if (i == 0) {
+    return last->bb_then;
+  }
+  return last->bb_else;
+}
+
+static Reg *ir_new_reg() {
+  Reg *reg = arena_calloc(codegen_arena, 1, sizeof(Reg));
+  reg->vn = curr_fn->regs->len;
+  reg->rn = -1;
+  reg->hint = -1;
+  list_append(curr_fn->regs, reg);
+  return reg;
+}
+
+static BB *ir_new_bb() {
+  BB *bb = arena_calloc(codegen_arena, 1, sizeof(BB));
+  bb->label = ++label_index;
+  bb->irs = list_new();
+  return bb;
+}
+
+static IR *ir_emit(IRKind kind, Reg *d, Reg *a, Reg *b) {
+  IR *ir = arena_calloc(codegen_arena, 1, sizeof(IR));
+  ir->kind = kind;
+  ir->d = d;
+  ir->a = a;
+  ir->b = b;
+  list_append(curr_bb->irs, ir);
+  return ir;
+}
+
+static void ir_jmp(BB *bb) {
+  IR *ir = ir_emit(IR_JMP, NULL, NULL, NULL);
+  ir->bb_then = bb;
+}
+
+static void ir_br(Reg *cond, BB *bb_then, BB *bb_else) {
+  IR *ir = ir_emit(IR_BR, NULL, cond, NULL);
+  ir->bb_then = bb_then;
+  ir->bb_else = bb_else;
+}
+
+static void ir_bcmp(IRKind kind, Reg *a, Reg *b, BB *bb_then, BB *bb_else) {
+  IR *ir = ir_emit(kind, NULL, a, b);
+  ir->bb_then = bb_then;
+  ir->bb_else = bb_else;
+}
+
+// bb から続きを生成する。いまのブロックが終わっていなければ bb に飛ばす
+static void ir_start_bb(BB *bb) {
+  IR *last = ir_last(curr_bb);
+  if (last == NULL) {
+    ir_jmp(bb);
+  } else if (!ir_is_terminator(last)) {
+    ir_jmp(bb);
+  }
+
+  list_append(curr_fn->bbs, bb);
+  curr_bb = bb;
+}
+
+static Reg *gen_imm(int val) {
+  Reg *d = ir_new_reg();
+  IR *ir = ir_emit(IR_IMM, d, NULL, NULL);
+  ir->imm = val;
+  return d;
+}
+
+static Reg *gen_binop(IRKind kind, Reg *a, Reg *b) {
+  Reg *d = ir_new_reg();
+  ir_emit(kind, d, a, b);
+  return d;
+}
+
+static Reg *gen_copy(Reg *a) {
+  Reg *d = ir_new_reg();
+  ir_emit(IR_MOV, d, a, NULL);
+  return d;
+}
+
+// 仮想レジスタに置いたローカル変数を書きかえるか。
+// 先に評価した変数の値をそのまま持っていてよいかの判断に使う
+static bool writes_reg_var(Node *node) {
+  if (node == NULL) {
+    return false;
+  }
+
+  if (node->kind == ND_ASSIGN || node->kind == ND_POSTINC) {
+    if (node->lhs->kind == ND_LVAR) {
+      if (node->lhs->lvar->reg != NULL) {
+        return true;
+      }
+    }
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      if (writes_reg_var(node->nodes->data[i])) {
+        return true;
+      }
+    }
+  }
+
+  return writes_reg_var(node->lhs) || writes_reg_var(node->rhs) ||
+         writes_reg_var(node->node3) || writes_reg_var(node->node4);
+}
+
+// 変数のレジスタを持ったまま later を評価すると値が変わってしまうときは
+// コピーしておく
+static Reg *gen_keep(Reg *reg, Node *later) {
+  if (reg->var == NULL) {
+    return reg;
+  }
+  if (!writes_reg_var(later)) {
+    return reg;
+  }
+  return gen_copy(reg);
+}
+
+static Reg *gen_expr(Node *node);
+static void gen_cond(Node *node, BB *bb_then, BB *bb_else);
+static Node *find_inline_callee(Node *call);
+static bool can_unroll(Node *node);
+static void gen_unrolled_for(Node *node, BB *bb_end);
+static bool can_vectorize(Node *node);
+static void gen_vector_for(Node *node, BB *bb_end);
+static Reg *gen_inline_call(Node *func, List *args);
+
+static void gen_operands(Node *node, Reg **lhs, Reg **rhs) {
+  *lhs = gen_keep(gen_expr(node->lhs), node->rhs);
+  *rhs = gen_expr(node->rhs);
+}
+
+static void gen_addr(Node *node, Addr *addr) {
+  addr->base = NULL;
+  addr->lvar = NULL;
+  addr->gvar = NULL;
+  addr->offset = 0;
+
+  if (node->kind == ND_LVAR) {
+    if (node->lvar->reg != NULL) {
+      error("variable in register has no address: '%.*s' (bug in gen_ir)",
+            node->lvar->len, node->lvar->name);
+    }
+    addr->lvar = node->lvar;
+    return;
+  }
+
+  // *y -> y の値をアドレスとする
+  if (node->kind == ND_DEREF) {
+    addr->base = gen_expr(node->lhs);
+    return;
+  }
+
+  if (node->kind == ND_GVAR) {
+    addr->gvar = node->gvar;
+    return;
+  }
+
+  if (node->kind == ND_MEMBER) {
+    Type *type = typeof_node(node->lhs);
+    Var *member =
+        find_var(type->members, token_str(node->ident), node->ident->len);
+    if (member == NULL) {
+      error("member not found: %.*s on (%s)", node->ident->len,
+            token_str(node->ident), type_to_string(type));
+    }
+
+    gen_addr(node->lhs, addr);
+    addr->offset = addr->offset + member->offset;
+    return;
+  }
+
+  error_at(node->source_pos, "not an lvalue: %s", node_kind_to_str(node->kind));
+}
+
+static Reg *gen_addr_reg(Addr *addr) {
+  if (addr->lvar != NULL) {
+    Reg *d = ir_new_reg();
+    IR *ir = ir_emit(IR_LADDR, d, NULL, NULL);
+    ir->lvar = addr->lvar;
+    ir->imm = addr->offset;
+    return d;
+  }
+
+  if (addr->gvar != NULL) {
+    Reg *d = ir_new_reg();
+    IR *ir = ir_emit(IR_GADDR, d, NULL, NULL);
+    ir->gvar = addr->gvar;
+    ir->imm = addr->offset;
+    return d;
+  }
+
+  if (addr->offset == 0) {
+    return addr->base;
+  }
+
+  Reg *d = ir_new_reg();
+  IR *ir = ir_emit(IR_ADDI, d, addr->base, NULL);
+  ir->imm = addr->offset;
+  return d;
+}
+
+static Reg *gen_load(Type *type, Addr *addr) {
+  Reg *d = ir_new_reg();
+  IR *ir = ir_emit(IR_LOAD, d, addr->base, NULL);
+  ir->lvar = addr->lvar;
+  ir->gvar = addr->gvar;
+  ir->imm = addr->offset;
+  ir->size = sizeof_type(type);
+  return d;
+}
+
+static void gen_store(Type *type, Addr *addr, Reg *val) {
+  IR *ir = ir_emit(IR_STORE, NULL, addr->base, val);
+  ir->lvar = addr->lvar;
+  ir->gvar = addr->gvar;
+  ir->imm = addr->offset;
+  ir->size = sizeof_type(type);
+}
+
+// レジスタに置いた変数に代入する。メモリに置いたときと同じく型の幅に切りつめる
+static void gen_assign_reg_var(Var *var, Reg *val) {
+  int size = sizeof_type(var->type);
+  if (size == 8) {
+    ir_emit(IR_MOV, var->reg, val, NULL);
+    return;
+  }
+
+  IR *ir = ir_emit(IR_SEXT, var->reg, val, NULL);
+  ir->size = size;
+}
+
+static bool is_reg_var_node(Node *node) {
+  if (node->kind != ND_LVAR) {
+    return false;
+  }
+  return node->lvar->reg != NULL;
+}
+
+static Reg *gen_call(Node *node) {
+  // FIXME: __builtin_va_start に #define してからよびたい
+  if (node->ident->len == 8 &&
+      strncmp("va_start", token_str(node->ident), node->ident->len) == 0) {
+    if (curr_fn->varargs_index == -1) {
+      error("va_start must be called in a function with varargs");
+    }
+
+    // 最初の引数 ap だけ渡す。一般化できるといいけどとりあえず。
+    Node *ap = node->nodes->data[0];
+    Addr addr;
+    gen_addr(ap, &addr);
+
+    Reg *d = ir_new_reg();
+    IR *ir = ir_emit(IR_VASTART, d, NULL, NULL);
+    ir->imm = curr_fn->varargs_index;
+
+    IR *store = ir_emit(IR_STORE, NULL, addr.base, d);
+    store->lvar = addr.lvar;
+    store->gvar = addr.gvar;
+    store->imm = addr.offset;
+    store->size = 8;
+    return d;
+  }
+
+  if (node->nodes->len > 8) {
+    error_at(node->source_pos, "too many arguments");
+  }
+
+  List *args = list_new();
+  for (int i = 0; i < node->nodes->len; i++) {
+    Reg *arg = gen_expr(node->nodes->data[i]);
+    for (int j = i + 1; j < node->nodes->len; j++) {
+      arg = gen_keep(arg, node->nodes->data[j]);
+    }
+    list_append(args, arg);
+  }
+
+  Node *callee = find_inline_callee(node);
+  if (callee != NULL) {
+    return gen_inline_call(callee, args);
+  }
+
+  Reg *d = ir_new_reg();
+  IR *ir = ir_emit(IR_CALL, d, NULL, NULL);
+  ir->ident = node->ident;
+  ir->args = args;
+  return d;
+}
+
+static Reg *gen_postinc(Node *node, bool want_value) {
+  Type *type = typeof_node(node->lhs);
+
+  if (is_reg_var_node(node->lhs)) {
+    Var *var = node->lhs->lvar;
+    Reg *old = NULL;
+    if (want_value) {
+      old = gen_copy(var->reg);
+    }
+
+    Reg *inc = ir_new_reg();
+    IR *ir = ir_emit(IR_ADDI, inc, var->reg, NULL);
+    ir->imm = node->val;
+    gen_assign_reg_var(var, inc);
+    return old;
+  }
+
+  Addr addr;
+  gen_addr(node->lhs, &addr);
+  Reg *old = gen_load(type, &addr);
+  Reg *inc = ir_new_reg();
+  IR *ir = ir_emit(IR_ADDI, inc, old, NULL);
+  ir->imm = node->val;
+  gen_store(type, &addr, inc);
+  return old;
+}
+
+static Reg *gen_add_sub(Node *node) {
+  int lptr_size = 0;
+  int rptr_size = 0;
+
+  // TODO: ltype しかみてないけど rtype もみたいよね
+  Type *ltype = typeof_node(node->lhs);
+  if (ltype->ty == TY_PTR || ltype->ty == TY_ARRAY) {
+    lptr_size = sizeof_type(ltype->base);
+  }
+
+  Type *rtype = typeof_node(node->rhs);
+  if (rtype->ty == TY_PTR || rtype->ty == TY_ARRAY) {
+    rptr_size = sizeof_type(rtype->base);
+  }
+
+  Reg *lhs;
+  Reg *rhs;
+  gen_operands(node, &lhs, &rhs);
+
+  IRKind kind = node->kind == ND_ADD ? IR_ADD : IR_SUB;
+
+  if (lptr_size > 1) {
+    if (rptr_size > 1) {
+      if (node->kind != ND_SUB) {
+        error("must not happen (bug in parser)");
+      }
+      if (lptr_size != rptr_size) {
+        error("pointer arithmetic with different pointer types");
+      }
+
+      // ptr - ptr は減算したうえで base の size で割る。
+      // 割り切れるので、2 のべき乗ならシフトするだけでよい
+      Reg *diff = gen_binop(IR_SUB, lhs, rhs);
+      int shift = exact_log2(lptr_size);
+      if (shift > 0) {
+        Reg *d = ir_new_reg();
+        IR *ir = ir_emit(IR_SRAI, d, diff, NULL);
+        ir->imm = shift;
+        return d;
+      }
+      return gen_binop(IR_DIV, diff, gen_imm(lptr_size));
+    }
+
+    // ptr + int は int のほうを size 倍する
+    rhs = gen_binop(IR_MUL, rhs, gen_imm(lptr_size));
+  }
+
+  return gen_binop(kind, lhs, rhs);
+}
+
+static Reg *gen_expr(Node *node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return gen_imm(node->val);
+
+  case ND_ADD:
+  case ND_SUB:
+    return gen_add_sub(node);
+
+  case ND_MUL:
+  case ND_DIV:
+  case ND_LT:
+  case ND_GE:
+  case ND_EQ:
+  case ND_NE: {
+    Reg *lhs;
+    Reg *rhs;
+    gen_operands(node, &lhs, &rhs);
+
+    IRKind kind;
+    switch (node->kind) {
+    case ND_MUL:
+      kind = IR_MUL;
+      break;
+    case ND_DIV:
+      kind = IR_DIV;
+      break;
+    case ND_LT:
+      kind = IR_LT;
+      break;
+    case ND_GE:
+      kind = IR_GE;
+      break;
+    case ND_EQ:
+      kind = IR_EQ;
+      break;
+    default:
+      kind = IR_NE;
+      break;
+    }
+    return gen_binop(kind, lhs, rhs);
+  }
+
+  case ND_LOGOR:
+  case ND_LOGAND: {
+    BB *bb_true = ir_new_bb();
+    BB *bb_false = ir_new_bb();
+    BB *bb_end = ir_new_bb();
+    Reg *d = ir_new_reg();
+
+    gen_cond(node, bb_true, bb_false);
+
+    ir_start_bb(bb_true);
+    ir_emit(IR_MOV, d, gen_imm(1), NULL);
+    ir_jmp(bb_end);
+
+    ir_start_bb(bb_false);
+    ir_emit(IR_MOV, d, gen_imm(0), NULL);
+
+    ir_start_bb(bb_end);
+    return d;
+  }
+
+  case ND_LVAR: {
+    if (node->lvar->reg != NULL) {
+      return node->lvar->reg;
+    }
+
+    Addr addr;
+    gen_addr(node, &addr);
+    if (node->lvar->type->ty == TY_ARRAY) {
+      // 配列の場合は先頭要素へのポインタに変換されるのでアドレスを返す
+      // sizeof, & の場合だけ例外だがそれはそちら側で処理されてる。はず。
+      return gen_addr_reg(&addr);
+    }
+    return gen_load(node->lvar->type, &addr);
+  }
+
+  case ND_ASSIGN: {
+    if (is_reg_var_node(node->lhs)) {
+      Var *var = node->lhs->lvar;
+      gen_assign_reg_var(var, gen_expr(node->rhs));
+      return var->reg;
+    }
+
+    Addr addr;
+    gen_addr(node->lhs, &addr);
+    if (addr.base != NULL) {
+      addr.base = gen_keep(addr.base, node->rhs);
+    }
+    Reg *val = gen_expr(node->rhs);
+    gen_store(typeof_node(node->lhs), &addr, val);
+    return val;
+  }
+
+  case ND_COND: {
+    BB *bb_then = ir_new_bb();
+    BB *bb_else = ir_new_bb();
+    BB *bb_end = ir_new_bb();
+    Reg *d = ir_new_reg();
+
+    gen_cond(node->lhs, bb_then, bb_else);
+
+    ir_start_bb(bb_then);
+    ir_emit(IR_MOV, d, gen_expr(node->rhs), NULL);
+    ir_jmp(bb_end);
+
+    ir_start_bb(bb_else);
+    ir_emit(IR_MOV, d, gen_expr(node->node3), NULL);
+
+    ir_start_bb(bb_end);
+    return d;
+  }
+
+  case ND_CALL:
+    return gen_call(node);
+
+  case ND_DEREF: {
+    Reg *addr_reg = gen_expr(node->lhs);
+
+    if (typeof_node(node)->ty == TY_ARRAY) {
+      // deref した結果が配列の場合はさらにポインタとしてあつかうので
+      // 求めたアドレスをそのまま返す
+      return addr_reg;
+    }
+
+    Addr addr;
+    addr.base = addr_reg;
+    addr.lvar = NULL;
+    addr.gvar = NULL;
+    addr.offset = 0;
+    return gen_load(typeof_node(node->lhs)->base, &addr);
+  }
+
+  case ND_ADDR: {
+    Addr addr;
+    gen_addr(node->lhs, &addr);
+    return gen_addr_reg(&addr);
+  }
+
+  case ND_GVAR: {
+    Addr addr;
+    gen_addr(node, &addr);
+    if (node->gvar->type->ty == TY_ARRAY) {
+      return gen_addr_reg(&addr);
+    }
+    return gen_load(node->gvar->type, &addr);
+  }
+
+  case ND_STRING: {
+    Reg *d = ir_new_reg();
+    IR *ir = ir_emit(IR_SADDR, d, NULL, NULL);
+    ir->imm = node->val;
+    return d;
+  }
+
+  case ND_MEMBER: {
+    Type *type = typeof_node(node->lhs);
+    if (type->ty != TY_STRUCT) {
+      error("not a struct: (%s)", type_to_string(type));
+    }
+
+    Addr addr;
+    gen_addr(node, &addr);
+
+    Type *member_type = typeof_node(node);
+    if (member_type->ty == TY_ARRAY) {
+      return gen_addr_reg(&addr);
+    }
+    return gen_load(member_type, &addr);
+  }
+
+  case ND_NOT: {
+    Reg *d = ir_new_reg();
+    ir_emit(IR_NOT, d, gen_expr(node->lhs), NULL);
+    return d;
+  }
+
+  case ND_POSTINC:
+    return gen_postinc(node, true);
+
+  case ND_COMMA:
+    gen_expr(node->lhs);
+    return gen_expr(node->rhs);
+
+  case ND_RETURN:
+  case ND_IF:
+  case ND_SWITCH:
+  case ND_WHILE:
+  case ND_FOR:
+  case ND_BLOCK:
+  case ND_FUNCDECL:
+  case ND_VARDECL:
+  case ND_GVARDECL:
+  case ND_BREAK:
+  case ND_CONTINUE:
+  case ND_CASE:
+  case ND_DEFAULT:
+  case ND_VARARGS:
+  case ND_NOP:
+    break;
+  }
+
+  error_at(node->source_pos, "not an expression: %s",
+           node_kind_to_str(node->kind));
+}
+
+static void gen_init_struct_var(Node *node_var, Type *type, List *inits) {
+  for (int i = 0; i < type->members->len; i++) {
+    Var *member = type->members->data[i];
+
+    Node *mem = new_node(ND_MEMBER, node_var, NULL);
+    mem->ident = arena_calloc(codegen_arena, 1, sizeof(Token));
+    mem->ident->pos = member->name - user_input;
+    mem->ident->len = member->len;
+
+    // ここで初期化されていないメンバーは 0 で初期化する
+    Node *init;
+    if (i < inits->len) {
+      init = inits->data[i];
+    } else {
+      init = new_node(ND_NUM, NULL, NULL);
+    }
+
+    gen_expr(new_node(ND_ASSIGN, mem, init));
+  }
+}
+
+static JumpTarget *push_jump_target(Node *node, BB *bb_break,
+                                    BB *bb_continue) {
+  JumpTarget *target = arena_calloc(codegen_arena, 1, sizeof(JumpTarget));
+  target->label_index = node->label_index;
+  target->bb_break = bb_break;
+  target->bb_continue = bb_continue;
+  list_append(jump_targets, target);
+  return target;
+}
+
+static JumpTarget *find_jump_target(Node *node) {
+  for (int i = jump_targets->len - 1; i >= 0; i--) {
+    JumpTarget *target = jump_targets->data[i];
+    if (target->label_index == node->label_index) {
+      return target;
+    }
+  }
+
+  error_at(node->source_pos, "jump target not found (bug in parser)");
+}
+
+static BB *find_case_bb(Node *node) {
+  for (int i = 0; i < case_bbs->len; i++) {
+    BB *bb = case_bbs->data[i];
+    if (bb->label == node->label_index) {
+      return bb;
+    }
+  }
+
+  error_at(node->source_pos, "case label not in switch");
+}
+
+// 条件式 node を評価して、真なら bb_then、偽なら bb_else に飛ぶ。
+// 比較はその場で分岐命令にし、0/1 の値を作らない
+static void gen_cond(Node *node, BB *bb_then, BB *bb_else) {
+  switch (node->kind) {
+  case ND_NOT:
+    gen_cond(node->lhs, bb_else, bb_then);
+    return;
+
+  case ND_LT:
+  case ND_GE:
+  case ND_EQ:
+  case ND_NE: {
+    Reg *lhs;
+    Reg *rhs;
+    gen_operands(node, &lhs, &rhs);
+
+    IRKind kind;
+    if (node->kind == ND_LT) {
+      kind = IR_BLT;
+    } else if (node->kind == ND_GE) {
+      kind = IR_BGE;
+    } else if (node->kind == ND_EQ) {
+      kind = IR_BEQ;
+    } else {
+      kind = IR_BNE;
+    }
+    ir_bcmp(kind, lhs, rhs, bb_then, bb_else);
+    return;
+  }
+
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    // 左辺で結果が決まれば右辺は評価しない
+    BB *bb_rhs = ir_new_bb();
+    if (node->kind == ND_LOGAND) {
+      gen_cond(node->lhs, bb_rhs, bb_else);
+    } else {
+      gen_cond(node->lhs, bb_then, bb_rhs);
+    }
+    ir_start_bb(bb_rhs);
+    gen_cond(node->rhs, bb_then, bb_else);
+    return;
+  }
+
+  default:
+    break;
+  }
+
+  ir_br(gen_expr(node), bb_then, bb_else);
+}
+
+static void gen_stmt(Node *node);
+
+// first から last までの幅が n * 3 以下か。符号がちがうと last - first は
+// int からあふれることがあるので、そのときは first に足して比べる
+static bool is_dense_cases(int first, int last, int n) {
+  int max_span = n * 3 - 1;
+  if (first < 0 && 0 <= last) {
+    return last <= first + max_span;
+  }
+  return last - first <= max_span;
+}
+
+// 値の昇順に並んだ cases の [from, to) のどれかに飛ぶ。どれでもなければ
+// bb_default に飛ぶ。値が密に並んでいれば表を引いて飛び、そうでなければ
+// 真ん中の値と比べて二分探索する
+static void gen_switch_dispatch(Reg *val, List *cases, int from, int to,
+                                BB *bb_default) {
+  int n = to - from;
+
+  if (n >= 4) {
+    SwitchCase *first = cases->data[from];
+    SwitchCase *last = cases->data[to - 1];
+    if (is_dense_cases(first->val, last->val, n)) {
+      IR *ir = ir_emit(IR_SWITCH, NULL, val, NULL);
+      ir->imm = first->val;
+      ir->bb_else = bb_default;
+      ir->targets = list_new();
+      int range = last->val - first->val + 1;
+      int k = from;
+      for (int i = 0; i < range; i++) {
+        SwitchCase *sc = cases->data[k];
+        if (sc->val == first->val + i) {
+          list_append(ir->targets, sc->bb);
+          k++;
+        } else {
+          list_append(ir->targets, bb_default);
+        }
+      }
+      return;
+    }
+  }
+
+  if (n <= 3) {
+    for (int i = from; i < to; i++) {
+      SwitchCase *sc = cases->data[i];
+      BB *bb_next = ir_new_bb();
+      ir_bcmp(IR_BEQ, val, gen_imm(sc->val), sc->bb, bb_next);
+      ir_start_bb(bb_next);
+    }
+    ir_jmp(bb_default);
+    return;
+  }
+
+  int mid = from + n / 2;
+  SwitchCase *pivot = cases->data[mid];
+  BB *bb_low = ir_new_bb();
+  BB *bb_high = ir_new_bb();
+  ir_bcmp(IR_BLT, val, gen_imm(pivot->val), bb_low, bb_high);
+
+  ir_start_bb(bb_low);
+  gen_switch_dispatch(val, cases, from, mid, bb_default);
+  ir_start_bb(bb_high);
+  gen_switch_dispatch(val, cases, mid, to, bb_default);
+}
+
+// switch の本体にある case と default を labels に集める。if やブロックの
+// 中にあるものも集めるが、入れ子の switch のものはそちらで集める
+static void find_case_labels(Node *node, List *labels) {
+  if (node == NULL || node->kind == ND_SWITCH) {
+    return;
+  }
+  if (node->kind == ND_CASE || node->kind == ND_DEFAULT) {
+    list_append(labels, node);
+    return;
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      find_case_labels(node->nodes->data[i], labels);
+    }
+  }
+  find_case_labels(node->lhs, labels);
+  find_case_labels(node->rhs, labels);
+  find_case_labels(node->node3, labels);
+  find_case_labels(node->node4, labels);
+}
+
+static void gen_switch(Node *node) {
+  Reg *val = gen_expr(node->lhs);
+  BB *bb_break = ir_new_bb();
+
+  List *labels = list_new(); // of Node *
+  find_case_labels(node->rhs, labels);
+
+  BB *bb_default = bb_break;
+  List *cases = list_new(); // of SwitchCase *, 値の昇順
+  for (int i = 0; i < labels->len; i++) {
+    Node *stmt = labels->data[i];
+
+    BB *bb = ir_new_bb();
+    bb->label = stmt->label_index;
+    list_append(case_bbs, bb);
+
+    if (stmt->kind == ND_DEFAULT) {
+      bb_default = bb;
+      continue;
+    }
+
+    SwitchCase *sc = arena_calloc(codegen_arena, 1, sizeof(SwitchCase));
+    sc->val = stmt->val;
+    sc->bb = bb;
+    list_append(cases, sc);
+
+    // 挿入ソート
+    for (int j = cases->len - 1; j > 0; j--) {
+      SwitchCase *prev = cases->data[j - 1];
+      if (prev->val == sc->val) {
+        error_at(stmt->source_pos, "duplicate case value");
+      }
+      if (prev->val < sc->val) {
+        break;
+      }
+      cases->data[j] = prev;
+      cases->data[j - 1] = sc;
+    }
+  }
+  gen_switch_dispatch(val, cases, 0, cases->len, bb_default);
+
+  push_jump_target(node, bb_break, NULL);
+  ir_start_bb(ir_new_bb());
+  gen_stmt(node->rhs);
+  jump_targets->len--;
+
+  ir_start_bb(bb_break);
+}
+
+// for ループの初期化より後ろを生成する。終わったら bb_end に飛ぶ
+static void gen_for_loop(Node *node, BB *bb_end) {
+  BB *bb_body = ir_new_bb();
+  BB *bb_continue = ir_new_bb();
+
+  if (node->rhs) {
+    gen_cond(node->rhs, bb_body, bb_end);
+  }
+
+  push_jump_target(node, bb_end, bb_continue);
+  ir_start_bb(bb_body);
+  if (node->node4) {
+    gen_stmt(node->node4);
+  }
+  jump_targets->len--;
+
+  // i++ みたいなとこ
+  ir_start_bb(bb_continue);
+  if (node->node3) {
+    gen_stmt(node->node3);
+  }
+  if (node->rhs) {
+    gen_cond(node->rhs, bb_body, bb_end);
+  } else {
+    ir_jmp(bb_body);
+  }
+}
+
+static void gen_stmt(Node *node) {
+  switch (node->kind) {
+  case ND_POSTINC:
+    // 値を使わないので古い値をとっておかなくてよい
+    gen_postinc(node, false);
+    return;
+
+  case ND_NUM:
+  case ND_LT:
+  case ND_GE:
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LOGOR:
+  case ND_LOGAND:
+  case ND_LVAR:
+  case ND_ASSIGN:
+  case ND_COND:
+  case ND_CALL:
+  case ND_DEREF:
+  case ND_ADDR:
+  case ND_GVAR:
+  case ND_STRING:
+  case ND_MEMBER:
+  case ND_NOT:
+  case ND_COMMA:
+    gen_expr(node);
+    return;
+
+  case ND_RETURN:
+    if (inline_end != NULL) {
+      if (node->lhs) {
+        ir_emit(IR_MOV, inline_ret, gen_expr(node->lhs), NULL);
+      }
+      ir_jmp(inline_end);
+      ir_start_bb(ir_new_bb());
+      return;
+    }
+
+    if (node->lhs) {
+      ir_emit(IR_RET, NULL, gen_expr(node->lhs), NULL);
+    } else {
+      ir_emit(IR_RET, NULL, NULL, NULL);
+    }
+    ir_start_bb(ir_new_bb());
+    return;
+
+  case ND_IF: {
+    BB *bb_then = ir_new_bb();
+    BB *bb_else = ir_new_bb();
+    BB *bb_end = ir_new_bb();
+
+    gen_cond(node->lhs, bb_then, node->node3 ? bb_else : bb_end);
+
+    ir_start_bb(bb_then);
+    gen_stmt(node->rhs);
+
+    if (node->node3) {
+      ir_jmp(bb_end);
+      ir_start_bb(bb_else);
+      gen_stmt(node->node3);
+    }
+
+    ir_start_bb(bb_end);
+    return;
+  }
+
+  case ND_SWITCH:
+    gen_switch(node);
+    return;
+
+  // ループは入口で一度だけ条件を調べ、以降は本体の後ろで調べて戻る
+  case ND_WHILE: {
+    BB *bb_body = ir_new_bb();
+    BB *bb_cond = ir_new_bb();
+    BB *bb_end = ir_new_bb();
+
+    gen_cond(node->lhs, bb_body, bb_end);
+
+    push_jump_target(node, bb_end, bb_cond);
+    ir_start_bb(bb_body);
+    gen_stmt(node->rhs);
+    jump_targets->len--;
+
+    ir_start_bb(bb_cond);
+    gen_cond(node->lhs, bb_body, bb_end);
+
+    ir_start_bb(bb_end);
+    return;
+  }
+
+  case ND_FOR: {
+    BB *bb_end = ir_new_bb();
+    if (node->lhs) {
+      gen_stmt(node->lhs);
+    }
+    if (can_vectorize(node)) {
+      gen_vector_for(node, bb_end);
+    } else if (can_unroll(node)) {
+      gen_unrolled_for(node, bb_end);
+    } else {
+      gen_for_loop(node, bb_end);
+    }
+    ir_start_bb(bb_end);
+    return;
+  }
+
+  case ND_BLOCK:
+    for (int i = 0; i < node->nodes->len; i++) {
+      gen_stmt(node->nodes->data[i]);
+    }
+    return;
+
+  case ND_VARDECL: {
+    Node *lvar = arena_calloc(codegen_arena, 1, sizeof(Node));
+    lvar->kind = ND_LVAR;
+    lvar->lvar = node->lvar;
+
+    if (node->rhs) {
+      gen_expr(new_node(ND_ASSIGN, lvar, node->rhs));
+    } else if (node->nodes) {
+      if (node->lvar->type->ty == TY_STRUCT) {
+        gen_init_struct_var(lvar, node->lvar->type, node->nodes);
+      } else {
+        error("not implemented for type (%s)", type_to_string(node->type));
+      }
+    }
+    return;
+  }
+
+  case ND_BREAK:
+    ir_jmp(find_jump_target(node)->bb_break);
+    ir_start_bb(ir_new_bb());
+    return;
+
+  case ND_CONTINUE:
+    ir_jmp(find_jump_target(node)->bb_continue);
+    ir_start_bb(ir_new_bb());
+    return;
+
+  case ND_CASE:
+  case ND_DEFAULT:
+    ir_start_bb(find_case_bb(node));
+    return;
+
+  case ND_VARARGS:
+  case ND_NOP:
+    return;
+
+  case ND_FUNCDECL:
+  case ND_GVARDECL:
+    break;
+  }
+
+  error_at(node->source_pos, "gen_ir not implemented: %s",
+           node_kind_to_str(node->kind));
+}
+
+static void mark_addr_taken(List *addr_taken, Node *node) {
+  // &x, &x.member のいずれも x のアドレスをとっている
+  while (node->kind == ND_MEMBER) {
+    node = node->lhs;
+  }
+
+  if (node->kind == ND_LVAR) {
+    list_append(addr_taken, node->lvar);
+  }
+}
+
+static void find_addr_taken(List *addr_taken, Node *node) {
+  if (node == NULL) {
+    return;
+  }
+
+  if (node->kind == ND_ADDR) {
+    mark_addr_taken(addr_taken, node->lhs);
+  }
+
+  if (node->kind == ND_CALL) {
+    if (node->ident->len == 8 &&
+        strncmp(token_str(node->ident), "va_start", 8) == 0) {
+      // va_start は ap のアドレスに書きこむ
+      mark_addr_taken(addr_taken, node->nodes->data[0]);
+    }
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      find_addr_taken(addr_taken, node->nodes->data[i]);
+    }
+  }
+
+  find_addr_taken(addr_taken, node->lhs);
+  find_addr_taken(addr_taken, node->rhs);
+  find_addr_taken(addr_taken, node->node3);
+  find_addr_taken(addr_taken, node->node4);
+}
+
+static bool is_scalar_type(Type *type) {
+  if (type->ty == TY_TYPEDEF) {
+    return is_scalar_type(type->base);
+  }
+
+  return type->ty == TY_INT || type->ty == TY_CHAR || type->ty == TY_PTR ||
+         type->ty == TY_ENUM;
+}
+
+// アドレスをとられないスカラーの変数を仮想レジスタに置く
+static void assign_var_regs(Node *func) {
+  List *addr_taken = list_new();
+  for (int i = 0; i < func->nodes->len; i++) {
+    find_addr_taken(addr_taken, func->nodes->data[i]);
+  }
+
+  for (int i = 0; i < func->locals->len; i++) {
+    Var *var = func->locals->data[i];
+    var->reg = NULL;
+
+    if (!is_scalar_type(var->type)) {
+      continue;
+    }
+
+    bool taken = false;
+    for (int j = 0; j < addr_taken->len; j++) {
+      if (addr_taken->data[j] == var) {
+        taken = true;
+      }
+    }
+    if (taken) {
+      continue;
+    }
+
+    var->reg = ir_new_reg();
+    var->reg->var = var;
+  }
+}
+
+// インライン展開
+//
+// 本体のノードの数が opt_inline_threshold 以下の関数と、プログラム中で
+// 一か所からしか呼ばれずその INLINE_SINGLE_CALL_FACTOR 倍以下の関数を
+// 展開する。展開した関数も、ほかのファイルから呼ばれるかもしれないので
+// そのまま出力する。
+//
+// 展開するたびに、呼ばれる関数の変数に新しい仮想レジスタを割り当てる。
+// そのため変数がすべて仮想レジスタに置ける関数だけを展開する。
+// switch の case はノードのラベル番号をそのまま使うので、二度は生成できない
+
+#define INLINE_MAX_DEPTH 3
+#define INLINE_SINGLE_CALL_FACTOR 4
+
+typedef struct InlineInfo InlineInfo;
+
+struct InlineInfo {
+  Node *func;
+  int size;      // 本体のノードの数
+  int num_calls; // 呼ばれている箇所の数
+  bool can_inline;
+};
+
+static List *inline_infos;     // of InlineInfo *
+static List *inline_info_syms; // 関数名の sym から InlineInfo *
+
+static InlineInfo *find_inline_info(Token *ident) {
+  return sym_lookup(inline_info_syms, ident->sym);
+}
+
+static int count_nodes(Node *node) {
+  if (node == NULL) {
+    return 0;
+  }
+
+  int n = 1;
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      n += count_nodes(node->nodes->data[i]);
+    }
+  }
+  return n + count_nodes(node->lhs) + count_nodes(node->rhs) +
+         count_nodes(node->node3) + count_nodes(node->node4);
+}
+
+static void count_calls(Node *node) {
+  if (node == NULL) {
+    return;
+  }
+
+  if (node->kind == ND_CALL) {
+    InlineInfo *info = find_inline_info(node->ident);
+    if (info != NULL) {
+      info->num_calls++;
+    }
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      count_calls(node->nodes->data[i]);
+    }
+  }
+  count_calls(node->lhs);
+  count_calls(node->rhs);
+  count_calls(node->node3);
+  count_calls(node->node4);
+}
+
+// node の中に kind のノードがあるか
+static bool has_node(Node *node, NodeKind kind) {
+  if (node == NULL) {
+    return false;
+  }
+
+  if (node->kind == kind) {
+    return true;
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      if (has_node(node->nodes->data[i], kind)) {
+        return true;
+      }
+    }
+  }
+  return has_node(node->lhs, kind) || has_node(node->rhs, kind) ||
+         has_node(node->node3, kind) || has_node(node->node4, kind);
+}
+
+static bool can_inline(Node *func) {
+  for (int i = 0; i < func->args->len; i++) {
+    Node *arg = func->args->data[i];
+    if (arg->kind == ND_VARARGS) {
+      return false;
+    }
+  }
+
+  List *addr_taken = list_new();
+  for (int i = 0; i < func->nodes->len; i++) {
+    Node *stmt = func->nodes->data[i];
+    if (has_node(stmt, ND_SWITCH)) {
+      return false;
+    }
+    find_addr_taken(addr_taken, stmt);
+  }
+
+  for (int i = 0; i < func->locals->len; i++) {
+    Var *var = func->locals->data[i];
+    if (!is_scalar_type(var->type)) {
+      return false;
+    }
+    for (int j = 0; j < addr_taken->len; j++) {
+      if (addr_taken->data[j] == var) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void plan_inlining() {
+  inline_infos = list_new();
+  inline_info_syms = list_new();
+  for (int i = 0; i < code->len; i++) {
+    Node *node = code->data[i];
+    if (node->kind != ND_FUNCDECL) {
+      continue;
+    }
+
+    InlineInfo *info = arena_calloc(ast_arena, 1, sizeof(InlineInfo));
+    info->func = node;
+    for (int j = 0; j < node->nodes->len; j++) {
+      info->size += count_nodes(node->nodes->data[j]);
+    }
+    info->can_inline = can_inline(node);
+    list_append(inline_infos, info);
+    sym_define(inline_info_syms, node->ident->sym, info);
+  }
+
+  for (int i = 0; i < inline_infos->len; i++) {
+    InlineInfo *info = inline_infos->data[i];
+    for (int j = 0; j < info->func->nodes->len; j++) {
+      count_calls(info->func->nodes->data[j]);
+    }
+  }
+}
+
+// 呼び出し call をその場で展開するなら、呼ばれる関数を返す
+static Node *find_inline_callee(Node *call) {
+  if (opt_inline_threshold <= 0) {
+    return NULL;
+  }
+  if (inline_infos == NULL) {
+    plan_inlining();
+  }
+
+  InlineInfo *info = find_inline_info(call->ident);
+  if (info == NULL) {
+    return NULL;
+  }
+  if (!info->can_inline || info->func->args->len != call->nodes->len) {
+    return NULL;
+  }
+
+  // 再帰呼び出しは展開しない
+  if (info->func == curr_fn->node) {
+    return NULL;
+  }
+  if (inline_stack->len >= INLINE_MAX_DEPTH) {
+    return NULL;
+  }
+  for (int i = 0; i < inline_stack->len; i++) {
+    if (inline_stack->data[i] == info->func) {
+      return NULL;
+    }
+  }
+
+  if (info->size <= opt_inline_threshold) {
+    return info->func;
+  }
+  if (info->num_calls == 1) {
+    if (info->size <= opt_inline_threshold * INLINE_SINGLE_CALL_FACTOR) {
+      return info->func;
+    }
+  }
+  return NULL;
+}
+
+// 評価ずみの引数 args で func の本体を生成し、返り値のレジスタを返す
+static Reg *gen_inline_call(Node *func, List *args) {
+  List *saved_regs = list_new(); // of Reg *
+  for (int i = 0; i < func->locals->len; i++) {
+    Var *var = func->locals->data[i];
+    list_append(saved_regs, var->reg);
+    var->reg = ir_new_reg();
+    var->reg->var = var;
+  }
+
+  for (int i = 0; i < args->len; i++) {
+    Node *param = func->args->data[i];
+    gen_assign_reg_var(param->lvar, args->data[i]);
+  }
+
+  Reg *saved_ret = inline_ret;
+  BB *saved_end = inline_end;
+  Reg *d = ir_new_reg();
+  BB *bb_end = ir_new_bb();
+  inline_ret = d;
+  inline_end = bb_end;
+  list_append(inline_stack, func);
+
+  for (int i = 0; i < func->nodes->len; i++) {
+    gen_stmt(func->nodes->data[i]);
+  }
+
+  // 最後まで来たら 0 を返す
+  ir_emit(IR_MOV, d, gen_imm(0), NULL);
+  ir_start_bb(bb_end);
+
+  inline_stack->len--;
+  inline_ret = saved_ret;
+  inline_end = saved_end;
+  for (int i = 0; i < func->locals->len; i++) {
+    Var *var = func->locals->data[i];
+    var->reg = saved_regs->data[i];
+  }
+  return d;
+}
+
+// ループ展開
+//
+// for (i = c; i < n; i += step) の形で、本体が i も n も書きかえない
+// ループは、本体と i += step を opt_unroll 回並べたものを
+// i < n - (opt_unroll - 1) * step のあいだくりかえし、残りをもとのループで
+// まわす。i と n は仮想レジスタに置いた int の変数か定数に限る。
+// n から引く (opt_unroll - 1) * step が int に収まらなければ展開しない。
+// 引き算は 64 ビットの足し算でするので、n が int の端でもあふれない。
+// 回数が定数で opt_unroll で割りきれるときは残りのループを作らない
+
+#define UNROLL_MAX_NODES 200
+
+static bool writes_var(Node *node, Var *var) {
+  if (node == NULL) {
+    return false;
+  }
+
+  if (node->kind == ND_ASSIGN || node->kind == ND_POSTINC) {
+    if (node->lhs->kind == ND_LVAR && node->lhs->lvar == var) {
+      return true;
+    }
+  }
+
+  if (node->nodes != NULL) {
+    for (int i = 0; i < node->nodes->len; i++) {
+      if (writes_var(node->nodes->data[i], var)) {
+        return true;
+      }
+    }
+  }
+  return writes_var(node->lhs, var) || writes_var(node->rhs, var) ||
+         writes_var(node->node3, var) || writes_var(node->node4, var);
+}
+
+static bool is_lvar_of(Node *node, Var *var) {
+  return node->kind == ND_LVAR && node->lvar == var;
+}
+
+// ループの変数。i < n または n >= i (i <= n) の i
+static Var *unroll_var(Node *cond) {
+  Node *i;
+  if (cond->kind == ND_LT) {
+    i = cond->lhs;
+  } else if (cond->kind == ND_GE) {
+    i = cond->rhs;
+  } else {
+    return NULL;
+  }
+
+  if (i->kind != ND_LVAR || i->lvar->reg == NULL) {
+    return NULL;
+  }
+  if (i->lvar->type->ty != TY_INT) {
+    return NULL;
+  }
+  return i->lvar;
+}
+
+// ループの上限。i < n なら n、n >= i なら n + 1 (を足す前の n と 1)
+static Node *unroll_bound(Node *cond, int *plus) {
+  if (cond->kind == ND_LT) {
+    *plus = 0;
+    return cond->rhs;
+  }
+  *plus = 1;
+  return cond->lhs;
+}
+
+// i++, i += c, i = i + c の c。それ以外なら 0
+static int unroll_step(Node *inc, Var *var) {
+  if (inc->kind == ND_POSTINC && is_lvar_of(inc->lhs, var)) {
+    return inc->val;
+  }
+
+  if (inc->kind == ND_ASSIGN && is_lvar_of(inc->lhs, var)) {
+    Node *rhs = inc->rhs;
+    if (rhs->kind == ND_ADD && is_lvar_of(rhs->lhs, var)) {
+      if (rhs->rhs->kind == ND_NUM) {
+        return rhs->rhs->val;
+      }
+    }
+  }
+  return 0;
+}
+
+static bool can_unroll(Node *node) {
+  if (opt_unroll < 2) {
+    return false;
+  }
+  if (node->rhs == NULL || node->node3 == NULL || node->node4 == NULL) {
+    return false;
+  }
+
+  Var *var = unroll_var(node->rhs);
+  if (var == NULL) {
+    return false;
+  }
+  int step = unroll_step(node->node3, var);
+  if (step <= 0 || step > INT_MAX / (opt_unroll - 1)) {
+    return false;
+  }
+
+  int plus;
+  Node *bound = unroll_bound(node->rhs, &plus);
+  if (bound->kind == ND_LVAR) {
+    if (bound->lvar->reg == NULL || writes_var(node->node4, bound->lvar)) {
+      return false;
+    }
+  } else if (bound->kind != ND_NUM) {
+    return false;
+  }
+
+  if (writes_var(node->node4, var) || has_node(node->node4, ND_SWITCH)) {
+    return false;
+  }
+  // 本体を複製するので、外側の switch の case が中にあってはいけない
+  if (has_node(node->node4, ND_CASE) || has_node(node->node4, ND_DEFAULT)) {
+    return false;
+  }
+  // いちばん内側のループだけを展開する
+  if (has_node(node->node4, ND_FOR) || has_node(node->node4, ND_WHILE)) {
+    return false;
+  }
+  return count_nodes(node->node4) * opt_unroll <= UNROLL_MAX_NODES;
+}
+
+// 回数が定数で opt_unroll で割りきれるか
+static bool unroll_has_no_rest(Node *node, Var *var, int step) {
+  Node *init = node->lhs;
+  if (init == NULL) {
+    return false;
+  }
+
+  Node *start = NULL;
+  if (init->kind == ND_VARDECL && init->lvar == var) {
+    start = init->rhs;
+  } else if (init->kind == ND_ASSIGN && is_lvar_of(init->lhs, var)) {
+    start = init->rhs;
+  }
+  if (start == NULL) {
+    return false;
+  }
+
+  int plus;
+  Node *bound = unroll_bound(node->rhs, &plus);
+  if (start->kind != ND_NUM || bound->kind != ND_NUM) {
+    return false;
+  }
+
+  // 幅や 1 周ぶんの幅が int からあふれるときは残りのループを作る
+  if (sub_overflows(bound->val, start->val) || step > INT_MAX / opt_unroll) {
+    return false;
+  }
+  int span = bound->val - start->val;
+  if (span < 0 || span == INT_MAX) {
+    return false;
+  }
+  span += plus;
+  int chunk = step * opt_unroll;
+  return span / chunk * chunk == span;
+}
+
+static void gen_unrolled_for(Node *node, BB *bb_end) {
+  Var *var = unroll_var(node->rhs);
+  int step = unroll_step(node->node3, var);
+  int plus;
+  Node *bound = unroll_bound(node->rhs, &plus);
+
+  Reg *limit;
+  int sub = (opt_unroll - 1) * step - plus;
+  if (bound->kind == ND_NUM && !sub_overflows(bound->val, sub)) {
+    limit = gen_imm(bound->val - sub);
+  } else {
+    Reg *n;
+    if (bound->kind == ND_NUM) {
+      n = gen_imm(bound->val);
+    } else {
+      n = bound->lvar->reg;
+    }
+    limit = ir_new_reg();
+    IR *ir = ir_emit(IR_ADDI, limit, n, NULL);
+    ir->imm = 0 - sub;
+  }
+
+  BB *bb_body = ir_new_bb();
+  BB *bb_rest = ir_new_bb();
+  ir_bcmp(IR_BLT, var->reg, limit, bb_body, bb_rest);
+
+  ir_start_bb(bb_body);
+  for (int i = 0; i < opt_unroll; i++) {
+    BB *bb_continue = ir_new_bb();
+    push_jump_target(node, bb_end, bb_continue);
+    gen_stmt(node->node4);
+    jump_targets->len--;
+
+    ir_start_bb(bb_continue);
+    gen_stmt(node->node3);
+  }
+  ir_bcmp(IR_BLT, var->reg, limit, bb_body, bb_rest);
+
+  ir_start_bb(bb_rest);
+  if (unroll_has_no_rest(node, var, step)) {
+    ir_jmp(bb_end);
+  } else {
+    gen_for_loop(node, bb_end);
+  }
+}
+
+// ベクトル化
+//
+// -march=rv64gcv のとき、for (i = c; i < n; i++) (i <= n も) の本体が
+//   a[i] = 式;   (要素ごとの演算、同じ値で埋める、コピー)
+//   s = s + 式;  (総和。s += 式, s -= 式 も)
+// の文だけからなるループは、vsetvli が返す要素数ずつ RVV の命令で
+// まとめて処理する (strip mining)。式は a[i] と、ループの中で変わらない
+// スカラーの +, -, * からなる。要素は int か char で、ひとつのループの中では
+// 大きさをそろえる。総和をとるのは int の要素だけ。
+// a は配列の変数か、ポインタの変数。ポインタはほかの配列とずれて
+// 重なっているかもしれないので、書きこむループでは読み書きする変数が
+// ひとつだけのときに限る。
+
+#define VEC_NUM_REGS ((32 - VEC_FIRST_REG) / VEC_LMUL)
+
+typedef struct VecBase VecBase;
+
+// ベクトル化したループで読み書きする配列
+struct VecBase {
+  Node *node; // ND_LVAR か ND_GVAR
+  Reg *ptr;   // 処理している要素を指すポインタ
+};
+
+static Var *vec_var;       // ループの変数 i
+static Node *vec_index;    // i の ND_LVAR
+static int vec_size;       // 要素の大きさ。まだ決まっていなければ 0
+static List *vec_bases;    // of VecBase *
+static List *vec_sums;     // of Var *, 総和をとる変数
+static bool vec_has_store; // 配列に書きこむか
+static List *vec_scalars;  // of Reg *, ループの前に求めたスカラー
+static int vec_scalar_pos; // vec_scalars の次に使うもの
+
+static Var *vec_base_var(Node *node) {
+  if (node->kind == ND_LVAR) {
+    return node->lvar;
+  }
+  if (node->kind == ND_GVAR) {
+    return node->gvar;
+  }
+  return NULL;
+}
+
+static VecBase *find_vec_base(Node *node) {
+  Var *var = vec_base_var(node);
+  for (int i = 0; i < vec_bases->len; i++) {
+    VecBase *base = vec_bases->data[i];
+    if (vec_base_var(base->node) == var) {
+      return base;
+    }
+  }
+  return NULL;
+}
+
+// a[i] の a を覚える。使えない変数なら false
+static bool add_vec_base(Node *node) {
+  if (vec_base_var(node) == NULL) {
+    return false;
+  }
+
+  Type *type = typeof_node(node);
+  if (type->ty != TY_ARRAY && type->ty != TY_PTR) {
+    return false;
+  }
+  if (type->base->ty != TY_INT && type->base->ty != TY_CHAR) {
+    return false;
+  }
+
+  int size = sizeof_type(type->base);
+  if (vec_size == 0) {
+    vec_size = size;
+  } else if (vec_size != size) {
+    return false;
+  }
+
+  if (find_vec_base(node) == NULL) {
+    VecBase *base = arena_calloc(codegen_arena, 1, sizeof(VecBase));
+    base->node = node;
+    list_append(vec_bases, base);
+  }
+  return true;
+}
+
+static bool is_vec_sum(Var *var) {
+  for (int i = 0; i < vec_sums->len; i++) {
+    if (vec_sums->data[i] == var) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// a[i] か
+static bool is_vec_elem(Node *node) {
+  if (node->kind != ND_DEREF || node->lhs->kind != ND_ADD) {
+    return false;
+  }
+  return is_lvar_of(node->lhs->rhs, vec_var);
+}
+
+// ループの中で変わらないスカラーの値か
+static bool is_vec_scalar(Node *node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return true;
+  case ND_LVAR: {
+    Var *var = node->lvar;
+    if (var->reg == NULL || var == vec_var || is_vec_sum(var)) {
+      return false;
+    }
+    Type *type = typeof_node(node);
+    return type->ty == TY_INT || type->ty == TY_CHAR;
+  }
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+    return is_vec_scalar(node->lhs) && is_vec_scalar(node->rhs);
+  default:
+    return false;
+  }
+}
+
+// node を求めるのに使うベクトルレジスタの数。スカラーなら 0、
+// ベクトル化できなければ -1
+static int vec_need(Node *node) {
+  if (is_vec_scalar(node)) {
+    return 0;
+  }
+  if (is_vec_elem(node)) {
+    if (!add_vec_base(node->lhs->lhs)) {
+      return -1;
+    }
+    return 1;
+  }
+  if (node->kind != ND_ADD && node->kind != ND_SUB && node->kind != ND_MUL) {
+    return -1;
+  }
+
+  // 左を求めたレジスタを持ったまま右を求める
+  int l = vec_need(node->lhs);
+  int r = vec_need(node->rhs);
+  if (l < 0 || r < 0) {
+    return -1;
+  }
+  if (l == 0) {
+    return r;
+  }
+  if (r == 0 || l > r) {
+    return l;
+  }
+  return r + 1;
+}
+
+// 総和をとる文か
+static bool is_vec_sum_stmt(Node *stmt) {
+  return stmt->lhs->kind == ND_LVAR;
+}
+
+// 文ひとつに使うベクトルレジスタの数。ベクトル化できなければ -1
+static int vec_stmt_need(Node *stmt) {
+  Node *lhs = stmt->lhs;
+  if (is_vec_elem(lhs)) {
+    if (!add_vec_base(lhs->lhs->lhs)) {
+      return -1;
+    }
+    vec_has_store = true;
+
+    int need = vec_need(stmt->rhs);
+    if (need == 0) {
+      return 1; // 同じ値で埋める
+    }
+    return need;
+  }
+
+  if (lhs->kind != ND_LVAR) {
+    return -1;
+  }
+
+  // s = s + e, s = s - e
+  Node *rhs = stmt->rhs;
+  if (rhs->kind != ND_ADD && rhs->kind != ND_SUB) {
+    return -1;
+  }
+  if (!is_lvar_of(rhs->lhs, lhs->lvar)) {
+    return -1;
+  }
+  int need = vec_need(rhs->rhs);
+  if (need == 0) {
+    return -1;
+  }
+  return need;
+}
+
+static List *vec_stmts(Node *body) {
+  if (body->kind == ND_BLOCK) {
+    return body->nodes;
+  }
+  List *stmts = list_new();
+  list_append(stmts, body);
+  return stmts;
+}
+
+static bool can_vectorize(Node *node) {
+  if (!opt_vector) {
+    return false;
+  }
+  if (node->rhs == NULL || node->node3 == NULL || node->node4 == NULL) {
+    return false;
+  }
+
+  vec_var = unroll_var(node->rhs);
+  if (vec_var == NULL) {
+    return false;
+  }
+  if (unroll_step(node->node3, vec_var) != 1) {
+    return false;
+  }
+  if (node->rhs->kind == ND_LT) {
+    vec_index = node->rhs->lhs;
+  } else {
+    vec_index = node->rhs->rhs;
+  }
+
+  vec_size = 0;
+  vec_bases = list_new();
+  vec_sums = list_new();
+  vec_has_store = false;
+
+  // 先に総和をとる変数を集める。式の中でスカラーとして使ってはいけない
+  List *stmts = vec_stmts(node->node4);
+  if (stmts->len == 0) {
+    return false;
+  }
+  for (int i = 0; i < stmts->len; i++) {
+    Node *stmt = stmts->data[i];
+    if (stmt->kind != ND_ASSIGN) {
+      return false;
+    }
+    if (is_vec_sum_stmt(stmt)) {
+      Var *var = stmt->lhs->lvar;
+      if (var->reg == NULL || var->type->ty != TY_INT) {
+        return false;
+      }
+      if (var == vec_var || is_vec_sum(var)) {
+        return false;
+      }
+      list_append(vec_sums, var);
+    }
+  }
+
+  int plus;
+  Node *bound = unroll_bound(node->rhs, &plus);
+  if (bound->kind != ND_NUM) {
+    if (bound->kind != ND_LVAR || !is_vec_scalar(bound)) {
+      return false;
+    }
+  }
+
+  int max_need = 0;
+  for (int i = 0; i < stmts->len; i++) {
+    int need = vec_stmt_need(stmts->data[i]);
+    if (need < 0) {
+      return false;
+    }
+    if (need > max_need) {
+      max_need = need;
+    }
+  }
+  if (vec_sums->len + max_need > VEC_NUM_REGS) {
+    return false;
+  }
+  if (vec_sums->len > 0 && vec_size != 4) {
+    return false;
+  }
+
+  if (vec_has_store && vec_bases->len > 1) {
+    for (int i = 0; i < vec_bases->len; i++) {
+      VecBase *base = vec_bases->data[i];
+      if (typeof_node(base->node)->ty == TY_PTR) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// 式の中のスカラーをループの前で求めておく
+static void gen_vec_scalars(Node *node) {
+  if (is_vec_scalar(node)) {
+    list_append(vec_scalars, gen_expr(node));
+    return;
+  }
+  if (is_vec_elem(node)) {
+    return;
+  }
+  gen_vec_scalars(node->lhs);
+  gen_vec_scalars(node->rhs);
+}
+
+static Reg *next_vec_scalar() {
+  Reg *reg = vec_scalars->data[vec_scalar_pos];
+  vec_scalar_pos++;
+  return reg;
+}
+
+static int vec_sum_reg(Var *var) {
+  for (int i = 0; i < vec_sums->len; i++) {
+    if (vec_sums->data[i] == var) {
+      return VEC_FIRST_REG + i * VEC_LMUL;
+    }
+  }
+  error("not a sum variable: %.*s (bug in gen_ir)", var->len, var->name);
+}
+
+static IRKind vec_binop(NodeKind kind) {
+  if (kind == ND_ADD) {
+    return IR_VADD;
+  }
+  if (kind == ND_SUB) {
+    return IR_VSUB;
+  }
+  return IR_VMUL;
+}
+
+// node の値をベクトルレジスタ vr に求める。vr より後ろのレジスタも使う
+static void gen_vec_expr(Node *node, int vr) {
+  if (is_vec_scalar(node)) {
+    IR *ir = ir_emit(IR_VSPLAT, NULL, NULL, next_vec_scalar());
+    ir->vd = vr;
+    return;
+  }
+
+  if (is_vec_elem(node)) {
+    VecBase *base = find_vec_base(node->lhs->lhs);
+    IR *ir = ir_emit(IR_VLOAD, NULL, base->ptr, NULL);
+    ir->vd = vr;
+    ir->size = vec_size;
+    return;
+  }
+
+  IRKind kind = vec_binop(node->kind);
+  IR *ir;
+  if (is_vec_scalar(node->lhs)) {
+    Reg *scalar = next_vec_scalar();
+    gen_vec_expr(node->rhs, vr);
+    if (kind == IR_VSUB) {
+      kind = IR_VRSUB;
+    }
+    ir = ir_emit(kind, NULL, NULL, scalar);
+  } else if (is_vec_scalar(node->rhs)) {
+    gen_vec_expr(node->lhs, vr);
+    ir = ir_emit(kind, NULL, NULL, next_vec_scalar());
+  } else {
+    gen_vec_expr(node->lhs, vr);
+    gen_vec_expr(node->rhs, vr + VEC_LMUL);
+    ir = ir_emit(kind, NULL, NULL, NULL);
+    ir->vb = vr + VEC_LMUL;
+  }
+  ir->vd = vr;
+  ir->va = vr;
+}
+
+static void gen_vector_for(Node *node, BB *bb_end) {
+  int plus;
+  Node *bound = unroll_bound(node->rhs, &plus);
+  Reg *limit;
+  if (bound->kind == ND_NUM && (plus == 0 || bound->val < INT_MAX)) {
+    limit = gen_imm(bound->val + plus);
+  } else if (plus == 0) {
+    limit = bound->lvar->reg;
+  } else {
+    // i <= INT_MAX の INT_MAX + 1 も、64 ビットで足せば求まる
+    Reg *n;
+    if (bound->kind == ND_NUM) {
+      n = gen_imm(bound->val);
+    } else {
+      n = bound->lvar->reg;
+    }
+    limit = ir_new_reg();
+    IR *ir = ir_emit(IR_ADDI, limit, n, NULL);
+    ir->imm = plus;
+  }
+
+  BB *bb_pre = ir_new_bb();
+  BB *bb_loop = ir_new_bb();
+  BB *bb_done = ir_new_bb();
+  ir_bcmp(IR_BLT, vec_var->reg, limit, bb_pre, bb_end);
+
+  // 残りの要素数と、各配列の a + i を求めておく
+  ir_start_bb(bb_pre);
+  Reg *count = gen_binop(IR_SUB, limit, vec_var->reg);
+  for (int i = 0; i < vec_bases->len; i++) {
+    VecBase *base = vec_bases->data[i];
+    base->ptr = gen_expr(new_node(ND_ADD, base->node, vec_index));
+  }
+
+  List *stmts = vec_stmts(node->node4);
+  vec_scalars = list_new();
+  for (int i = 0; i < stmts->len; i++) {
+    Node *stmt = stmts->data[i];
+    if (is_vec_sum_stmt(stmt)) {
+      gen_vec_scalars(stmt->rhs->rhs);
+    } else {
+      gen_vec_scalars(stmt->rhs);
+    }
+  }
+
+  // 総和は要素ごとにためておき、最後に足しあわせる
+  if (vec_sums->len > 0) {
+    IR *ir = ir_emit(IR_VSETVL, ir_new_reg(), NULL, NULL);
+    ir->size = vec_size;
+    Reg *zero = gen_imm(0);
+    for (int i = 0; i < vec_sums->len; i++) {
+      ir = ir_emit(IR_VSPLAT, NULL, NULL, zero);
+      ir->vd = vec_sum_reg(vec_sums->data[i]);
+    }
+  }
+
+  ir_start_bb(bb_loop);
+  Reg *vl = ir_new_reg();
+  IR *setvl = ir_emit(IR_VSETVL, vl, count, NULL);
+  setvl->size = vec_size;
+
+  int vr = VEC_FIRST_REG + vec_sums->len * VEC_LMUL;
+  vec_scalar_pos = 0;
+  for (int i = 0; i < stmts->len; i++) {
+    Node *stmt = stmts->data[i];
+    if (is_vec_sum_stmt(stmt)) {
+      gen_vec_expr(stmt->rhs->rhs, vr);
+      int acc = vec_sum_reg(stmt->lhs->lvar);
+      IR *ir = ir_emit(vec_binop(stmt->rhs->kind), NULL, NULL, NULL);
+      ir->vd = acc;
+      ir->va = acc;
+      ir->vb = vr;
+    } else {
+      gen_vec_expr(stmt->rhs, vr);
+      VecBase *base = find_vec_base(stmt->lhs->lhs->lhs);
+      IR *ir = ir_emit(IR_VSTORE, NULL, base->ptr, NULL);
+      ir->va = vr;
+      ir->size = vec_size;
+    }
+  }
+
+  Reg *bytes = vl;
+  if (vec_size != 1) {
+    bytes = gen_binop(IR_MUL, vl, gen_imm(vec_size));
+  }
+  for (int i = 0; i < vec_bases->len; i++) {
+    VecBase *base = vec_bases->data[i];
+    ir_emit(IR_ADD, base->ptr, base->ptr, bytes);
+  }
+  ir_emit(IR_SUB, count, count, vl);
+  ir_br(count, bb_loop, bb_done);
+
+  ir_start_bb(bb_done);
+  if (vec_sums->len > 0) {
+    IR *ir = ir_emit(IR_VSETVL, ir_new_reg(), NULL, NULL);
+    ir->size = vec_size;
+    for (int i = 0; i < vec_sums->len; i++) {
+      Var *var = vec_sums->data[i];
+      Reg *sum = ir_new_reg();
+      ir = ir_emit(IR_VREDSUM, sum, var->reg, NULL);
+      ir->va = vec_sum_reg(var);
+      gen_assign_reg_var(var, sum);
+    }
+  }
+  gen_assign_reg_var(vec_var, limit);
+  ir_jmp(bb_end);
+}
+
+// 入口から辿りつけないブロックを取りのぞく
+static void remove_unreachable_bbs(IRFunc *fn) {
+  List *reachable = list_new();
+  list_append(reachable, fn->bbs->data[0]);
+
+  for (int i = 0; i < reachable->len; i++) {
+    BB *bb = reachable->data[i];
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      BB *succ = ir_succ(bb, j);
+      bool found = false;
+      for (int k = 0; k < reachable->len; k++) {
+        if (reachable->data[k] == succ) {
+          found = true;
+        }
+      }
+      if (!found) {
+        list_append(reachable, succ);
+      }
+    }
+  }
+
+  List *bbs = list_new();
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int k = 0; k < reachable->len; k++) {
+      if (reachable->data[k] == bb) {
+        list_append(bbs, bb);
+        break;
+      }
+    }
+  }
+  fn->bbs = bbs;
+}
+
+// 末尾呼び出し
+//
+// 呼び出しの直後に関数を抜けるところを見つけて、自分自身の呼び出しなら
+// 引数を入れなおして本体の先頭に飛ぶループに、ほかの関数の呼び出しなら
+// フレームを片づけてから飛ぶ IR_TAILCALL にする。
+// 呼ばれる側がこちらのフレームを指すポインタを受けとるかもしれないので、
+// フレームにローカル変数を置く関数と可変長引数の関数では行わない
+
+// bb が呼び出しの結果をそのまま返して終わるなら、その IR_CALL を返す
+static IR *find_tail_call(IRFunc *fn, BB *bb) {
+  int n = bb->irs->len;
+  IR *ret = bb->irs->data[n - 1];
+  if (ret->kind != IR_RET || n < 2) {
+    return NULL;
+  }
+
+  IR *call = bb->irs->data[n - 2];
+  if (call->kind == IR_CALL && ret->a == call->d) {
+    return call;
+  }
+
+  // void の関数は返り値を捨てるので、return; や最後の 0 を返すところも使える
+  if (fn->node->type->ty != TY_VOID) {
+    return NULL;
+  }
+  if (call->kind == IR_CALL) {
+    return call;
+  }
+  if (n >= 3 && call->kind == IR_IMM && call->d == ret->a) {
+    call = bb->irs->data[n - 3];
+    if (call->kind == IR_CALL) {
+      return call;
+    }
+  }
+  return NULL;
+}
+
+static bool is_self_call(IRFunc *fn, IR *call, int num_params) {
+  return call->ident->sym == fn->node->ident->sym &&
+         call->args->len == num_params;
+}
+
+static bool can_tail_call(IRFunc *fn) {
+  if (fn->varargs_index != -1) {
+    return false;
+  }
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->lvar != NULL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// 入口のブロックを IR_PARAM とそれ以降に分けて、後ろ半分を返す
+static BB *split_params(IRFunc *fn) {
+  BB *entry = fn->bbs->data[0];
+  int num_params = 0;
+  for (int i = 0; i < entry->irs->len; i++) {
+    IR *ir = entry->irs->data[i];
+    if (ir->kind == IR_PARAM) {
+      num_params = i + 1;
+    }
+  }
+
+  BB *body = ir_new_bb();
+  for (int i = num_params; i < entry->irs->len; i++) {
+    list_append(body->irs, entry->irs->data[i]);
+  }
+  entry->irs->len = num_params;
+  curr_bb = entry;
+  ir_jmp(body);
+
+  List *bbs = list_new();
+  list_append(bbs, entry);
+  list_append(bbs, body);
+  for (int i = 1; i < fn->bbs->len; i++) {
+    list_append(bbs, fn->bbs->data[i]);
+  }
+  fn->bbs = bbs;
+  return body;
+}
+
+static void gen_tail_calls(IRFunc *fn, Node *func) {
+  if (!can_tail_call(fn)) {
+    return;
+  }
+
+  int num_params = func->args->len;
+  BB *body = NULL;
+  for (int i = 0; i < fn->bbs->len; i++) {
+    IR *call = find_tail_call(fn, fn->bbs->data[i]);
+    if (call != NULL && is_self_call(fn, call, num_params)) {
+      body = split_params(fn);
+      break;
+    }
+  }
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    IR *call = find_tail_call(fn, bb);
+    if (call == NULL) {
+      continue;
+    }
+
+    // 呼び出しから後ろを捨てて、つくりなおす
+    int pos = 0;
+    while (bb->irs->data[pos] != call) {
+      pos++;
+    }
+    bb->irs->len = pos;
+    curr_bb = bb;
+
+    if (!is_self_call(fn, call, num_params)) {
+      IR *ir = ir_emit(IR_TAILCALL, NULL, NULL, NULL);
+      ir->ident = call->ident;
+      ir->args = call->args;
+      continue;
+    }
+
+    // 引数がほかの引数の変数そのものかもしれないので、先に全部コピーする
+    List *args = list_new();
+    for (int j = 0; j < num_params; j++) {
+      Reg *arg = call->args->data[j];
+      if (arg->var != NULL) {
+        arg = gen_copy(arg);
+      }
+      list_append(args, arg);
+    }
+    for (int j = 0; j < num_params; j++) {
+      Node *param = func->args->data[j];
+      gen_assign_reg_var(param->lvar, args->data[j]);
+    }
+    ir_jmp(body);
+  }
+}
+
+IRFunc *gen_ir(Node *func) {
+  assert(func->kind == ND_FUNCDECL);
+
+  IRFunc *fn = arena_calloc(codegen_arena, 1, sizeof(IRFunc));
+  fn->node = func;
+  fn->bbs = list_new();
+  fn->regs = list_new();
+  fn->varargs_index = -1;
+
+  curr_fn = fn;
+  jump_targets = list_new();
+  case_bbs = list_new();
+  inline_stack = list_new();
+  inline_ret = NULL;
+  inline_end = NULL;
+
+  for (int i = 0; i < func->args->len; i++) {
+    Node *arg = func->args->data[i];
+    if (arg->kind == ND_VARARGS) {
+      fn->varargs_index = i;
+    }
+  }
+
+  assign_var_regs(func);
+
+  curr_bb = ir_new_bb();
+  list_append(fn->bbs, curr_bb);
+
+  // 引数を a0- から受けとる
+  for (int i = 0; i < func->args->len; i++) {
+    Node *arg = func->args->data[i];
+    if (arg->kind == ND_VARARGS) {
+      break;
+    }
+
+    Var *var = arg->lvar;
+    Reg *d = var->reg;
+    if (d == NULL) {
+      d = ir_new_reg();
+    }
+    IR *ir = ir_emit(IR_PARAM, d, NULL, NULL);
+    ir->imm = i;
+    ir->size = var->reg != NULL ? sizeof_type(var->type) : 8;
+  }
+  for (int i = 0; i < func->args->len; i++) {
+    Node *arg = func->args->data[i];
+    if (arg->kind == ND_VARARGS) {
+      break;
+    }
+    if (arg->lvar->reg == NULL) {
+      IR *param = curr_bb->irs->data[i];
+      Addr addr;
+      gen_addr(arg, &addr);
+      gen_store(arg->lvar->type, &addr, param->d);
+    }
+  }
+
+  for (int i = 0; i < func->nodes->len; i++) {
+    gen_stmt(func->nodes->data[i]);
+  }
+
+  // 最後まで来たら 0 を返す
+  ir_emit(IR_RET, NULL, gen_imm(0), NULL);
+
+  remove_unreachable_bbs(fn);
+  gen_tail_calls(fn, func);
+
+  curr_fn = NULL;
+  curr_bb = NULL;
+  return fn;
+}
+
+static void ir_dump_reg(Reg *reg) {
+  if (reg == NULL) {
+    fprintf(stderr, "_");
+    return;
+  }
+
+  fprintf(stderr, "v%d", reg->vn);
+  if (reg->var != NULL) {
+    fprintf(stderr, "(%.*s)", reg->var->len, reg->var->name);
+  }
+}
+
+void ir_dump(IRFunc *fn) {
+  fprintf(stderr, "%.*s:\n", fn->node->ident->len, token_str(fn->node->ident));
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    fprintf(stderr, "bb%d:\n", bb->label);
+
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      fprintf(stderr, "  ");
+      if (ir->d != NULL) {
+        ir_dump_reg(ir->d);
+        fprintf(stderr, " = ");
+      }
+      fprintf(stderr, "%s ", ir_kind_to_str(ir->kind));
+      ir_dump_reg(ir->a);
+      fprintf(stderr, ", ");
+      ir_dump_reg(ir->b);
+      fprintf(stderr, " imm=%d", ir->imm);
+      if (ir->size != 0) {
+        fprintf(stderr, " size=%d", ir->size);
+      }
+      if (ir->vd != 0) {
+        fprintf(stderr, " vd=%d", ir->vd);
+      }
+      if (ir->va != 0) {
+        fprintf(stderr, " va=%d", ir->va);
+      }
+      if (ir->vb != 0) {
+        fprintf(stderr, " vb=%d", ir->vb);
+      }
+      if (ir->lvar != NULL) {
+        fprintf(stderr, " lvar=%.*s", ir->lvar->len, ir->lvar->name);
+      }
+      if (ir->gvar != NULL) {
+        fprintf(stderr, " gvar=%.*s", ir->gvar->len, ir->gvar->name);
+      }
+      if (ir->ident != NULL) {
+        fprintf(stderr, " call=%.*s", ir->ident->len, token_str(ir->ident));
+        for (int k = 0; k < ir->args->len; k++) {
+          fprintf(stderr, " ");
+          ir_dump_reg(ir->args->data[k]);
+        }
+      }
+      if (ir->bb_then != NULL) {
+        fprintf(stderr, " then=bb%d", ir->bb_then->label);
+      }
+      if (ir->bb_else != NULL) {
+        fprintf(stderr, " else=bb%d", ir->bb_else->label);
+      }
+      if (ir->targets != NULL) {
+        fprintf(stderr, " targets=");
+        for (int k = 0; k < ir->targets->len; k++) {
+          BB *target = ir->targets->data[k];
+          fprintf(stderr, "%sbb%d", k > 0 ? "," : "", target->label);
+        }
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+}
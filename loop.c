@@ -0,0 +1,849 @@
+// ループの最適化
+//
+// gen_ir が作った IR の上で自然ループを見つけ、内側のループから順に
+//   - ループの中で値の変わらない計算を、ループの直前のブロック (preheader)
+//     に出す (loop-invariant code motion)
+//   - 誘導変数 i について base + i * stride の形のアドレス計算を、i を
+//     増やすところで stride ずつ増やすレジスタに置きかえる
+//     (strength reduction)
+// をおこなう。
+//
+// ループの中で書かれないレジスタの値はループの中で変わらない。一度しか
+// 書かれない一時レジスタは、gen_ir の作りから定義がすべての使用に先立つ
+// ので、オペランドが変わらなければ定義ごとループの前に出してよい。
+// 定数はのぞき穴最適化で即値にできるようにループの中に残しておく。
+
+#include "mocc.h"
+
+typedef struct Loop Loop;
+
+struct Loop {
+  BB *header;
+  char *body; // fn->bbs の順に、ループに含まれるか
+  int size;
+};
+
+typedef struct DerivedIV DerivedIV;
+
+// base + iv * scale の値を持ちつづけるレジスタ p
+struct DerivedIV {
+  Reg *base;
+  Reg *iv;
+  int scale;
+  Reg *p;
+};
+
+// 関数全体の解析の結果。ブロックは fn->bbs での位置で表す
+static IRFunc *loop_fn;
+static int num_bbs;
+static int min_label;
+static int *index_of_label; // ラベルの番号 - min_label からブロックの位置
+static List *preds;         // of List *, ブロックごとの先行ブロック (of BB *)
+static int *idom;           // ブロックごとの直近の支配ブロック
+static int *rpo_num;        // ブロックごとの逆後順の番号
+static char *visited;
+static int num_visited;
+static List *loops; // of Loop *
+
+// 仮想レジスタの番号ごとの定義と使用の数
+static int *num_defs;
+static int *num_uses;
+static IR **def_ir;       // 定義。二度以上書かれるときは最後に見たもの
+static int *loop_defs;    // ループの中での定義の数
+static int num_counted;   // 数えたときのレジスタの数
+static char *iv_state;    // 誘導変数か。0 ならまだ調べていない、1 なら
+                          // そう、2 なら違う
+static Loop *curr_loop;
+static char *invariant;   // ループの前に出したか
+static List *hoisted;     // of IR *, preheader に出した命令
+
+static int bb_pos(BB *bb) {
+  return index_of_label[bb->label - min_label];
+}
+
+static IR *last_ir(BB *bb) {
+  return bb->irs->data[bb->irs->len - 1];
+}
+
+static Reg *loop_new_reg() {
+  Reg *reg = arena_calloc(codegen_arena, 1, sizeof(Reg));
+  reg->vn = loop_fn->regs->len;
+  reg->rn = -1;
+  reg->hint = -1;
+  list_append(loop_fn->regs, reg);
+  return reg;
+}
+
+static IR *new_ir(IRKind kind, Reg *d, Reg *a, Reg *b) {
+  IR *ir = arena_calloc(codegen_arena, 1, sizeof(IR));
+  ir->kind = kind;
+  ir->d = d;
+  ir->a = a;
+  ir->b = b;
+  return ir;
+}
+
+static void insert_ir(BB *bb, int at, IR *ir) {
+  list_append(bb->irs, ir);
+  for (int i = bb->irs->len - 1; i > at; i--) {
+    bb->irs->data[i] = bb->irs->data[i - 1];
+  }
+  bb->irs->data[at] = ir;
+}
+
+// preheader の最後のジャンプの前に足す
+static void append_to_preheader(BB *pre, IR *ir) {
+  insert_ir(pre, pre->irs->len - 1, ir);
+}
+
+static void index_bbs(IRFunc *fn) {
+  num_bbs = fn->bbs->len;
+
+  BB *entry = fn->bbs->data[0];
+  min_label = entry->label;
+  int max_label = entry->label;
+  for (int i = 0; i < num_bbs; i++) {
+    BB *bb = fn->bbs->data[i];
+    if (bb->label < min_label) {
+      min_label = bb->label;
+    }
+    if (bb->label > max_label) {
+      max_label = bb->label;
+    }
+  }
+
+  index_of_label =
+      arena_calloc(codegen_arena, max_label - min_label + 1, sizeof(int));
+  preds = list_new();
+  for (int i = 0; i < num_bbs; i++) {
+    BB *bb = fn->bbs->data[i];
+    index_of_label[bb->label - min_label] = i;
+    list_append(preds, list_new());
+  }
+
+  for (int i = 0; i < num_bbs; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      List *p = preds->data[bb_pos(ir_succ(bb, j))];
+      list_append(p, bb);
+    }
+  }
+}
+
+// 後順に番号をふり、あとで逆後順に直す
+static void number_postorder(BB *bb) {
+  int i = bb_pos(bb);
+  visited[i] = 1;
+  for (int j = 0; j < ir_num_succs(bb); j++) {
+    BB *succ = ir_succ(bb, j);
+    if (!visited[bb_pos(succ)]) {
+      number_postorder(succ);
+    }
+  }
+  rpo_num[i] = num_visited;
+  num_visited++;
+}
+
+static int intersect(int a, int b) {
+  while (a != b) {
+    while (rpo_num[a] > rpo_num[b]) {
+      a = idom[a];
+    }
+    while (rpo_num[b] > rpo_num[a]) {
+      b = idom[b];
+    }
+  }
+  return a;
+}
+
+// Cooper, Harvey, Kennedy の方法で直近の支配ブロックを求める
+static void compute_dominators(IRFunc *fn) {
+  visited = arena_calloc(codegen_arena, num_bbs, 1);
+  rpo_num = arena_calloc(codegen_arena, num_bbs, sizeof(int));
+  num_visited = 0;
+  number_postorder(fn->bbs->data[0]);
+
+  // 逆後順に並べたもの
+  int *order = arena_calloc(codegen_arena, num_bbs, sizeof(int));
+  for (int i = 0; i < num_bbs; i++) {
+    rpo_num[i] = num_bbs - 1 - rpo_num[i];
+    order[rpo_num[i]] = i;
+  }
+
+  idom = arena_calloc(codegen_arena, num_bbs, sizeof(int));
+  for (int i = 0; i < num_bbs; i++) {
+    idom[i] = -1;
+  }
+  idom[0] = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int k = 1; k < num_bbs; k++) {
+      int b = order[k];
+      List *p = preds->data[b];
+      int new_idom = -1;
+      for (int j = 0; j < p->len; j++) {
+        int pi = bb_pos(p->data[j]);
+        if (idom[pi] == -1) {
+          continue;
+        }
+        if (new_idom == -1) {
+          new_idom = pi;
+        } else {
+          new_idom = intersect(pi, new_idom);
+        }
+      }
+      if (idom[b] != new_idom) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+static bool dominates(int a, int b) {
+  for (;;) {
+    if (a == b) {
+      return true;
+    }
+    if (b == 0) {
+      return false;
+    }
+    b = idom[b];
+  }
+}
+
+// 後ろ向きの辺 tail -> header ごとに、tail から header を通らずに
+// さかのぼれるブロックをループに入れる。同じ header のループはまとめる
+static void find_loops(IRFunc *fn) {
+  loops = list_new();
+  int *stack = arena_calloc(codegen_arena, num_bbs, sizeof(int));
+
+  for (int tail = 0; tail < num_bbs; tail++) {
+    BB *bb = fn->bbs->data[tail];
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      BB *header = ir_succ(bb, j);
+      int h = bb_pos(header);
+      if (!dominates(h, tail)) {
+        continue;
+      }
+
+      Loop *loop = NULL;
+      for (int k = 0; k < loops->len; k++) {
+        Loop *l = loops->data[k];
+        if (l->header == header) {
+          loop = l;
+        }
+      }
+      if (loop == NULL) {
+        loop = arena_calloc(codegen_arena, 1, sizeof(Loop));
+        loop->header = header;
+        loop->body = arena_calloc(codegen_arena, num_bbs, 1);
+        loop->body[h] = 1;
+        loop->size = 1;
+        list_append(loops, loop);
+      }
+
+      int sp = 0;
+      if (!loop->body[tail]) {
+        loop->body[tail] = 1;
+        loop->size++;
+        stack[sp] = tail;
+        sp++;
+      }
+      while (sp > 0) {
+        sp--;
+        List *p = preds->data[stack[sp]];
+        for (int k = 0; k < p->len; k++) {
+          int pi = bb_pos(p->data[k]);
+          if (!loop->body[pi]) {
+            loop->body[pi] = 1;
+            loop->size++;
+            stack[sp] = pi;
+            sp++;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void analyze_loops(IRFunc *fn) {
+  index_bbs(fn);
+  compute_dominators(fn);
+  find_loops(fn);
+}
+
+// ループの外からの入口がジャンプで header に入るだけのブロックひとつなら、
+// それを preheader として返す
+static BB *find_preheader(Loop *loop) {
+  List *p = preds->data[bb_pos(loop->header)];
+  BB *pre = NULL;
+  for (int i = 0; i < p->len; i++) {
+    BB *bb = p->data[i];
+    if (loop->body[bb_pos(bb)]) {
+      continue;
+    }
+    if (pre != NULL) {
+      return NULL;
+    }
+    pre = bb;
+  }
+
+  if (pre == NULL) {
+    return NULL;
+  }
+  if (last_ir(pre)->kind != IR_JMP) {
+    return NULL;
+  }
+  return pre;
+}
+
+// header の直前に preheader を作り、ループの外からの辺をそこに向ける
+static void insert_preheader(IRFunc *fn, Loop *loop) {
+  BB *header = loop->header;
+  BB *pre = arena_calloc(codegen_arena, 1, sizeof(BB));
+  pre->label = ++label_index;
+  pre->irs = list_new();
+  IR *jmp = new_ir(IR_JMP, NULL, NULL, NULL);
+  jmp->bb_then = header;
+  list_append(pre->irs, jmp);
+
+  List *p = preds->data[bb_pos(header)];
+  for (int i = 0; i < p->len; i++) {
+    BB *bb = p->data[i];
+    if (loop->body[bb_pos(bb)]) {
+      continue;
+    }
+
+    IR *last = last_ir(bb);
+    if (last->bb_then == header) {
+      last->bb_then = pre;
+    }
+    if (last->bb_else == header) {
+      last->bb_else = pre;
+    }
+    if (last->targets != NULL) {
+      for (int j = 0; j < last->targets->len; j++) {
+        if (last->targets->data[j] == header) {
+          last->targets->data[j] = pre;
+        }
+      }
+    }
+  }
+
+  List *bbs = list_new();
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    if (bb == header) {
+      list_append(bbs, pre);
+    }
+    list_append(bbs, bb);
+  }
+  fn->bbs = bbs;
+}
+
+static void count_use(Reg *reg) {
+  if (reg != NULL) {
+    num_uses[reg->vn]++;
+  }
+}
+
+static void count_regs(IRFunc *fn, Loop *loop) {
+  int n = fn->regs->len;
+  num_counted = n;
+  num_defs = arena_calloc(codegen_arena, n, sizeof(int));
+  num_uses = arena_calloc(codegen_arena, n, sizeof(int));
+  def_ir = arena_calloc(codegen_arena, n, sizeof(IR *));
+  loop_defs = arena_calloc(codegen_arena, n, sizeof(int));
+  iv_state = arena_calloc(codegen_arena, n, 1);
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      count_use(ir->a);
+      count_use(ir->b);
+      if (ir->args != NULL) {
+        for (int k = 0; k < ir->args->len; k++) {
+          count_use(ir->args->data[k]);
+        }
+      }
+
+      if (ir->d == NULL) {
+        continue;
+      }
+      int vn = ir->d->vn;
+      num_defs[vn]++;
+      def_ir[vn] = ir;
+      if (loop->body[i]) {
+        loop_defs[vn]++;
+      }
+    }
+  }
+}
+
+// count_regs のあとで作ったレジスタか。数はわからない
+static bool is_new_reg(Reg *reg) {
+  return reg->vn >= num_counted;
+}
+
+// 一度しか書かれない一時レジスタか
+static bool is_temp(Reg *reg) {
+  if (is_new_reg(reg)) {
+    return false;
+  }
+  return reg->var == NULL && num_defs[reg->vn] == 1;
+}
+
+static bool is_const_reg(Reg *reg) {
+  if (is_new_reg(reg) || num_defs[reg->vn] != 1) {
+    return false;
+  }
+  return def_ir[reg->vn]->kind == IR_IMM;
+}
+
+static bool is_loop_invariant(Reg *reg) {
+  if (reg == NULL) {
+    return true;
+  }
+  return loop_defs[reg->vn] == 0 || invariant[reg->vn] || is_const_reg(reg);
+}
+
+static bool can_hoist(IR *ir) {
+  switch (ir->kind) {
+  case IR_MOV:
+  case IR_ADD:
+  case IR_ADDI:
+  case IR_SLLI:
+  case IR_SRAI:
+  case IR_SRLI:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_LT:
+  case IR_GE:
+  case IR_EQ:
+  case IR_NE:
+  case IR_AND:
+  case IR_OR:
+  case IR_NOT:
+  case IR_BOOL:
+  case IR_SEXT:
+  case IR_LADDR:
+  case IR_GADDR:
+  case IR_SADDR:
+    break;
+  default:
+    return false;
+  }
+
+  if (!is_temp(ir->d)) {
+    return false;
+  }
+  return is_loop_invariant(ir->a) && is_loop_invariant(ir->b);
+}
+
+static bool same_value(IR *x, IR *y) {
+  return x->kind == y->kind && x->a == y->a && x->b == y->b &&
+         x->imm == y->imm && x->size == y->size && x->lvar == y->lvar &&
+         x->gvar == y->gvar;
+}
+
+// preheader に出した命令で ir と同じ値を計算するもの
+static IR *find_hoisted(IR *ir) {
+  for (int i = 0; i < hoisted->len; i++) {
+    IR *h = hoisted->data[i];
+    if (same_value(h, ir)) {
+      return h;
+    }
+  }
+  return NULL;
+}
+
+static void replace_use(IR *ir, Reg *from, Reg *to);
+
+static void replace_reg(IRFunc *fn, Reg *from, Reg *to) {
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      replace_use(bb->irs->data[j], from, to);
+    }
+  }
+}
+
+// ir を preheader に出す。同じ値をもう出していればそちらを使う
+static void hoist(IRFunc *fn, IR *ir, BB *pre) {
+  invariant[ir->d->vn] = 1;
+
+  IR *h = find_hoisted(ir);
+  if (h != NULL) {
+    replace_reg(fn, ir->d, h->d);
+    return;
+  }
+
+  append_to_preheader(pre, ir);
+  list_append(hoisted, ir);
+}
+
+// ループの前に出す命令のオペランド。ループの中の定数は preheader に写す
+static Reg *hoist_operand(Reg *reg, BB *pre) {
+  if (reg == NULL) {
+    return NULL;
+  }
+  if (loop_defs[reg->vn] == 0 || invariant[reg->vn]) {
+    return reg;
+  }
+
+  IR *imm = new_ir(IR_IMM, NULL, NULL, NULL);
+  imm->imm = def_ir[reg->vn]->imm;
+  IR *h = find_hoisted(imm);
+  if (h != NULL) {
+    return h->d;
+  }
+  imm->d = loop_new_reg();
+  append_to_preheader(pre, imm);
+  list_append(hoisted, imm);
+  return imm->d;
+}
+
+static void hoist_invariants(IRFunc *fn, Loop *loop, BB *pre) {
+  invariant = arena_calloc(codegen_arena, fn->regs->len, 1);
+  hoisted = list_new();
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < fn->bbs->len; i++) {
+      if (!loop->body[i]) {
+        continue;
+      }
+
+      BB *bb = fn->bbs->data[i];
+      List *kept = list_new();
+      for (int j = 0; j < bb->irs->len; j++) {
+        IR *ir = bb->irs->data[j];
+        if (!can_hoist(ir)) {
+          list_append(kept, ir);
+          continue;
+        }
+
+        ir->a = hoist_operand(ir->a, pre);
+        ir->b = hoist_operand(ir->b, pre);
+        hoist(fn, ir, pre);
+        changed = true;
+      }
+      bb->irs = kept;
+    }
+  }
+}
+
+// def が i = i + step の形で reg を書くなら step を返す。
+// int の足し算はあふれないものとして、sext.w は見ない
+static bool find_iv_step(IR *def, Reg *reg, int *step) {
+  if (def->kind == IR_SEXT) {
+    if (def->size != 4) {
+      return false;
+    }
+  } else if (def->kind != IR_MOV) {
+    return false;
+  }
+
+  Reg *t = def->a;
+  if (!is_temp(t) || loop_defs[t->vn] != 1) {
+    return false;
+  }
+
+  IR *inc = def_ir[t->vn];
+  if (inc->kind == IR_ADDI && inc->a == reg) {
+    *step = inc->imm;
+    return true;
+  }
+  if (inc->kind == IR_ADD) {
+    if (inc->a == reg && is_const_reg(inc->b)) {
+      *step = def_ir[inc->b->vn]->imm;
+      return true;
+    }
+    if (inc->b == reg && is_const_reg(inc->a)) {
+      *step = def_ir[inc->a->vn]->imm;
+      return true;
+    }
+  }
+  if (inc->kind == IR_SUB && inc->a == reg && is_const_reg(inc->b)) {
+    *step = 0 - def_ir[inc->b->vn]->imm;
+    return true;
+  }
+  return false;
+}
+
+// reg がループの中で i = i + step の形でだけ書かれる誘導変数か。
+// 展開したループでは何度も書かれる
+static bool is_basic_iv(Reg *reg) {
+  if (is_new_reg(reg) || loop_defs[reg->vn] == 0) {
+    return false;
+  }
+  if (iv_state[reg->vn] == 0) {
+    iv_state[reg->vn] = 1;
+    for (int i = 0; i < loop_fn->bbs->len; i++) {
+      if (!curr_loop->body[i]) {
+        continue;
+      }
+      BB *bb = loop_fn->bbs->data[i];
+      for (int j = 0; j < bb->irs->len; j++) {
+        IR *ir = bb->irs->data[j];
+        int step;
+        if (ir->d == reg && !find_iv_step(ir, reg, &step)) {
+          iv_state[reg->vn] = 2;
+        }
+      }
+    }
+  }
+  return iv_state[reg->vn] == 1;
+}
+
+// offset が誘導変数の定数倍なら、その誘導変数と倍率を返す
+static Reg *match_iv_scaled(Reg *offset, int *scale) {
+  if (is_basic_iv(offset)) {
+    *scale = 1;
+    return offset;
+  }
+
+  if (!is_temp(offset) || loop_defs[offset->vn] != 1) {
+    return NULL;
+  }
+  IR *mul = def_ir[offset->vn];
+  if (mul->kind != IR_MUL) {
+    return NULL;
+  }
+  if (is_const_reg(mul->b) && is_basic_iv(mul->a)) {
+    *scale = def_ir[mul->b->vn]->imm;
+    return mul->a;
+  }
+  if (is_const_reg(mul->a) && is_basic_iv(mul->b)) {
+    *scale = def_ir[mul->a->vn]->imm;
+    return mul->b;
+  }
+  return NULL;
+}
+
+static DerivedIV *find_derived_iv(List *ivs, Reg *base, Reg *iv, int scale,
+                                  BB *pre) {
+  for (int i = 0; i < ivs->len; i++) {
+    DerivedIV *div = ivs->data[i];
+    if (div->base == base && div->iv == iv && div->scale == scale) {
+      return div;
+    }
+  }
+
+  DerivedIV *div = arena_calloc(codegen_arena, 1, sizeof(DerivedIV));
+  div->base = base;
+  div->iv = iv;
+  div->scale = scale;
+  div->p = loop_new_reg();
+  list_append(ivs, div);
+
+  // ループに入るときの値で初期化する
+  Reg *offset = iv;
+  if (scale != 1) {
+    Reg *s = loop_new_reg();
+    IR *imm = new_ir(IR_IMM, s, NULL, NULL);
+    imm->imm = scale;
+    append_to_preheader(pre, imm);
+    offset = loop_new_reg();
+    append_to_preheader(pre, new_ir(IR_MUL, offset, iv, s));
+  }
+  append_to_preheader(pre, new_ir(IR_ADD, div->p, base, offset));
+  return div;
+}
+
+static void replace_use(IR *ir, Reg *from, Reg *to) {
+  if (ir->a == from) {
+    ir->a = to;
+  }
+  if (ir->b == from) {
+    ir->b = to;
+  }
+  if (ir->args != NULL) {
+    for (int k = 0; k < ir->args->len; k++) {
+      if (ir->args->data[k] == from) {
+        ir->args->data[k] = to;
+      }
+    }
+  }
+}
+
+static int count_uses_in(IR *ir, Reg *reg) {
+  int n = 0;
+  if (ir->a == reg) {
+    n++;
+  }
+  if (ir->b == reg) {
+    n++;
+  }
+  if (ir->args != NULL) {
+    for (int k = 0; k < ir->args->len; k++) {
+      if (ir->args->data[k] == reg) {
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+// bb の j 番目の addr = base + iv * scale を p で置きかえる。addr の使用が
+// すべて同じブロックの中で p が増える前にあれば、使用を p に書きかえて
+// 命令を消す。そうでなければ mv にする。消したら true を返す
+static bool replace_with_derived(BB *bb, int j, DerivedIV *div) {
+  IR *ir = bb->irs->data[j];
+  Reg *addr = ir->d;
+
+  int n = 0;
+  int last = j;
+  for (int k = j + 1; k < bb->irs->len; k++) {
+    IR *use = bb->irs->data[k];
+    if (use->d == div->iv) {
+      break;
+    }
+    int m = count_uses_in(use, addr);
+    if (m > 0) {
+      n += m;
+      last = k;
+    }
+  }
+
+  if (n != num_uses[addr->vn]) {
+    ir->kind = IR_MOV;
+    ir->a = div->p;
+    ir->b = NULL;
+    return false;
+  }
+
+  for (int k = j + 1; k <= last; k++) {
+    replace_use(bb->irs->data[k], addr, div->p);
+  }
+  return true;
+}
+
+static void reduce_ivs(IRFunc *fn, Loop *loop, BB *pre) {
+  count_regs(fn, loop);
+  curr_loop = loop;
+
+  List *ivs = list_new(); // of DerivedIV *
+  for (int i = 0; i < fn->bbs->len; i++) {
+    if (!loop->body[i]) {
+      continue;
+    }
+
+    BB *bb = fn->bbs->data[i];
+    List *kept = list_new();
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind != IR_ADD || !is_temp(ir->d)) {
+        list_append(kept, ir);
+        continue;
+      }
+
+      Reg *base = ir->a;
+      int scale;
+      Reg *iv = NULL;
+      if (!is_new_reg(base) && loop_defs[base->vn] == 0) {
+        iv = match_iv_scaled(ir->b, &scale);
+      }
+      if (iv == NULL) {
+        base = ir->b;
+        if (!is_new_reg(base) && loop_defs[base->vn] == 0) {
+          iv = match_iv_scaled(ir->a, &scale);
+        }
+      }
+      if (iv == NULL) {
+        list_append(kept, ir);
+        continue;
+      }
+
+      DerivedIV *div = find_derived_iv(ivs, base, iv, scale, pre);
+      if (!replace_with_derived(bb, j, div)) {
+        list_append(kept, ir);
+      }
+    }
+    bb->irs = kept;
+  }
+
+  // 誘導変数を書いた直後に p も増やす
+  for (int i = 0; i < fn->bbs->len; i++) {
+    if (!loop->body[i]) {
+      continue;
+    }
+
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      for (int k = 0; k < ivs->len; k++) {
+        DerivedIV *div = ivs->data[k];
+        int step;
+        if (ir->d == div->iv && find_iv_step(ir, div->iv, &step)) {
+          IR *inc = new_ir(IR_ADDI, div->p, div->p, NULL);
+          inc->imm = step * div->scale;
+          j++;
+          insert_ir(bb, j, inc);
+        }
+      }
+    }
+  }
+}
+
+void optimize_loops(IRFunc *fn) {
+  loop_fn = fn;
+  List *done = list_new(); // of BB *, 処理したループの header
+
+  // 命令を動かしてもブロックの並びは変わらないので、解析しなおすのは
+  // preheader を足したときだけでよい
+  bool finished = false;
+  while (!finished) {
+    analyze_loops(fn);
+
+    bool cfg_changed = false;
+    while (!cfg_changed) {
+      // まだ処理していない、いちばん小さいループ
+      Loop *loop = NULL;
+      for (int i = 0; i < loops->len; i++) {
+        Loop *l = loops->data[i];
+        bool is_done = false;
+        for (int j = 0; j < done->len; j++) {
+          if (done->data[j] == l->header) {
+            is_done = true;
+          }
+        }
+        if (is_done) {
+          continue;
+        }
+        if (loop == NULL || l->size < loop->size) {
+          loop = l;
+        }
+      }
+      if (loop == NULL) {
+        finished = true;
+        break;
+      }
+
+      if (bb_pos(loop->header) == 0) {
+        list_append(done, loop->header);
+        continue;
+      }
+
+      BB *pre = find_preheader(loop);
+      if (pre == NULL) {
+        insert_preheader(fn, loop);
+        cfg_changed = true;
+        continue;
+      }
+
+      list_append(done, loop->header);
+      count_regs(fn, loop);
+      hoist_invariants(fn, loop, pre);
+      reduce_ivs(fn, loop, pre);
+    }
+  }
+
+  loop_fn = NULL;
+}
@@ -63,20 +63,53 @@ char *read_stdin() {
 
 char *user_input;
 char *input_filename;
+bool opt_dump_ir;
+int opt_inline_threshold;
+int opt_unroll;
+bool opt_vector;
+bool opt_schedule;
+bool opt_arena_stats;
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
+  arena_init();
+
+  input_filename = NULL;
+  opt_inline_threshold = 8;
+  opt_unroll = 4;
+  opt_schedule = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-dump-ir") == 0) {
+      opt_dump_ir = true;
+    } else if (strncmp(argv[i], "-inline-threshold=", 18) == 0) {
+      opt_inline_threshold = strtol(argv[i] + 18, NULL, 10);
+    } else if (strncmp(argv[i], "-unroll=", 8) == 0) {
+      opt_unroll = strtol(argv[i] + 8, NULL, 10);
+    } else if (strcmp(argv[i], "-march=rv64gcv") == 0) {
+      opt_vector = true;
+    } else if (strcmp(argv[i], "-march=rv64gc") == 0) {
+      opt_vector = false;
+    } else if (strcmp(argv[i], "-no-schedule") == 0) {
+      opt_schedule = false;
+    } else if (strcmp(argv[i], "-arena-stats") == 0) {
+      opt_arena_stats = true;
+    } else if (input_filename == NULL) {
+      input_filename = argv[i];
+    } else {
+      fprintf(stderr, "Bad argnum\n");
+      return 1;
+    }
+  }
+
+  if (input_filename == NULL) {
     fprintf(stderr, "Bad argnum\n");
     return 1;
   }
 
-  input_filename = argv[1];
-
-  if (strncmp(argv[1], "-", 1) == 0) {
+  if (strcmp(input_filename, "-") == 0) {
     user_input = read_stdin();
   } else {
     __debug_self("read_file");
-    user_input = read_file(argv[1]);
+    user_input = read_file(input_filename);
   }
 
   __debug_self("tokenize");
@@ -88,5 +121,9 @@ int main(int argc, char **argv) {
   __debug_self("codegen");
   codegen();
 
+  if (opt_arena_stats) {
+    arena_print_stats();
+  }
+
   return 0;
 }
@@ -8,6 +8,9 @@ typedef void *va_list;
 #define SEEK_SET 0
 #define SEEK_END 2
 
+#define INT_MAX 2147483647
+#define INT_MIN (-INT_MAX - 1)
+
 // extern void *stdin;
 // extern void *stderr;
 
@@ -38,12 +41,15 @@ extern int errno;
 int printf();
 int fopen();
 int strncmp();
+int strcmp();
 int strlen();
 int fprintf();
 char *strerror();
 int vsnprintf();
 int vfprintf();
 void *calloc();
+void free();
+void *memset();
 int isalnum();
 int isspace();
 int snprintf();
@@ -65,6 +71,7 @@ int feof();
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -77,6 +84,12 @@ int feof();
 
 extern char *user_input;
 extern char *input_filename;
+extern bool opt_dump_ir; // -dump-ir: 関数ごとの IR を stderr に出す
+extern int opt_inline_threshold; // -inline-threshold=N: 展開する関数の大きさ
+extern int opt_unroll; // -unroll=N: for ループを N 回分ずつ展開する
+extern bool opt_vector; // -march=rv64gcv: ループを RVV の命令でベクトル化する
+extern bool opt_schedule; // -no-schedule で false: 命令を並べかえない
+extern bool opt_arena_stats; // -arena-stats: アリーナの使用量を stderr に出す
 
 void codegen();
 
@@ -87,6 +100,7 @@ typedef struct Type Type;
 typedef struct Var Var;
 typedef struct String String;
 typedef struct Func Func;
+typedef struct Reg Reg;
 
 typedef enum {
 #define NODE_KIND(k) k,
@@ -141,12 +155,14 @@ struct Scope {
   Scope *parent;
   Node *node;
   int id;
+  int undo_len; // スコープに入ったときの、ローカル変数の表の書きかえの数
   // ここにブロック中のローカル変数も出てくるかもしれない
 };
 
 void parse_program();
 char *node_kind_to_str(NodeKind kind);
 Node *new_node(NodeKind kind, Node *lhs, Node *rhs);
+Node *new_node_num(int val);
 char *type_to_str(Type *type);
 void __debug_self(char *fmt, ...);
 
@@ -174,22 +190,28 @@ typedef enum {
   TK_EXTERN,
 } TokenKind;
 
+// トークンは tokenize で tokens に並べる。パーサは token_pos で読む位置を
+// 指す。Node や IR が持つ Token * は tokens の中を指す
 struct Token {
   TokenKind kind;
-  Token *next;
 
+  // TK_NUM のときは値、TK_PUNCT のときは記号を punct_id で数にしたもの
   int val;
+  int sym; // TK_IDENT のとき、名前を intern した番号
 
-  // ソースコード上の位置
-  char *str;
+  // ソースコード上の位置。user_input からのオフセット
+  int pos;
   int len;
 };
 
-extern Token *curr_token;
-extern Token *prev_token;
+extern Token *tokens; // 最後は TK_EOF
+extern int num_tokens;
+extern int token_pos;
 
 void tokenize(char *p);
 
+char *token_str(Token *tok);
+Token *token_peek(int n);
 Token *token_consume(TokenKind kind);
 bool token_consume_punct(char *op);
 bool token_consume_type(char *type);
@@ -235,6 +257,7 @@ struct Var {
   bool is_extern;
   int scope_id; // 同じ名前だけどスコープが違うものは別の変数になる。(name,
                 // scope_id) でユニークにする
+  Reg *reg;     // ローカル変数を仮想レジスタに置くとき。メモリなら NULL
 };
 
 // 文字列リテラル!!!
@@ -258,9 +281,10 @@ char *type_to_string(Type *type);
 Var *add_var(List *vars, char *name, int len, Type *type, bool is_extern,
              bool is_struct_member, int scope_id);
 Var *find_var(List *vars, char *name, int len);
+Var *add_lvar(List *vars, char *name, int len, Type *type, int scope_id);
 
 Type *add_or_find_defined_type(Type *type);
-Type *find_defined_type(char *name, int len);
+Type *find_defined_type(int sym);
 
 noreturn void error(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 noreturn void error_at(char *loc, char *fmt, ...)
@@ -276,8 +300,179 @@ List *list_new();
 int list_append(List *list, void *data);
 int list_concat(List *list, List *other);
 
-extern List *code;      // of Node *
-extern List *strings;   // of String *
-extern List *funcs;     // of Func *
-extern List *globals;   // of Var *
-extern List *constants; // of Var *
\ No newline at end of file
+int exact_log2(int val);
+bool add_overflows(int a, int b);
+bool sub_overflows(int a, int b);
+bool mul_overflows(int a, int b);
+
+// 段階ごとのアリーナ。arena_reset で中身をまとめて捨てる
+typedef struct Arena Arena;
+extern Arena *ast_arena;     // Node, Scope, String
+extern Arena *type_arena;    // Type, Var, Func
+extern Arena *codegen_arena; // 関数ひとつを出力するあいだだけ使うもの
+
+void arena_init();
+void *arena_alloc(Arena *arena, int size);
+void *arena_calloc(Arena *arena, int n, int size);
+void arena_reset(Arena *arena);
+void arena_print_stats();
+
+int intern(char *name, int len);
+void *sym_lookup(List *table, int sym);
+void sym_assign(List *table, int sym, void *data);
+void sym_define(List *table, int sym, void *data);
+
+extern int label_index;
+
+// 中間表現 (IR)
+// 関数ごとに、基本ブロックの列と仮想レジスタを使った三番地コードで表す
+
+typedef struct IR IR;
+typedef struct BB BB;
+typedef struct IRFunc IRFunc;
+
+typedef enum {
+#define IR_KIND(k) k,
+#include "ir_kind.def"
+#undef IR_KIND
+} IRKind;
+
+// 仮想レジスタ
+struct Reg {
+  int vn;   // 関数内での通し番号
+  Var *var; // ローカル変数そのものを置いているとき
+
+  // 以下は regalloc で決まる
+  int rn;         // 物理レジスタの x 番号。スピルしたときは -1
+  int spill_slot; // スピルしたときのフレーム上のスロット
+  int hint;       // できればこの物理レジスタにしたい。なければ -1
+  int start;      // 生存区間
+  int end;
+};
+
+// d = a op b のような命令
+struct IR {
+  IRKind kind;
+  Reg *d;
+  Reg *a;
+  Reg *b;
+  int imm;
+  int size;  // IR_LOAD, IR_STORE, IR_SEXT, IR_PARAM のときバイト数
+  Var *lvar; // IR_LOAD, IR_STORE, IR_LADDR でフレーム上の変数を指すとき
+  Var *gvar; // IR_LOAD, IR_STORE, IR_GADDR でグローバル変数を指すとき
+  Token *ident; // IR_CALL, IR_TAILCALL のときの関数名
+  List *args;   // IR_CALL, IR_TAILCALL のときの引数 (of Reg *)
+  BB *bb_then;  // IR_JMP と条件分岐の飛び先
+  BB *bb_else;  // 条件分岐で条件が成り立たないとき、IR_SWITCH で範囲外の飛び先
+  List *targets; // IR_SWITCH のとき a - imm 番目に飛ぶ先 (of BB *)
+
+  // IR_V* のときのベクトルレジスタの番号。vd = va op vb、b があれば
+  // vd = va op b
+  int vd;
+  int va;
+  int vb;
+};
+
+// ベクトルレジスタは v8 から VEC_LMUL 本ずつを組にして使う。
+// v1 は総和を求めるときに使う
+#define VEC_LMUL 4
+#define VEC_FIRST_REG 8
+#define VEC_SCRATCH_REG 1
+
+// 基本ブロック。最後の命令はかならず IR_JMP, IR_RET, IR_TAILCALL, IR_SWITCH
+// か条件分岐
+struct BB {
+  int label;
+  List *irs; // of IR *
+
+  // regalloc で使う。仮想レジスタの番号ごとに生きているかどうか
+  char *live_in;
+  char *live_out;
+};
+
+struct IRFunc {
+  Node *node; // ND_FUNCDECL
+  List *bbs;  // of BB *, 先頭が入口で、この順に出力する
+  List *regs; // of Reg *
+  int varargs_index;
+
+  // 以下は regalloc で決まる
+  int num_spill_slots;
+  char *used_regs; // 物理レジスタの番号ごとに、使ったかどうか
+};
+
+// RISC-V の x レジスタの番号
+#define NUM_PHYS_REGS 32
+#define REG_RA 1
+#define REG_SP 2
+#define REG_FP 8
+#define REG_A0 10
+#define REG_T5 30 // スピルした値を読み書きするための一時レジスタ
+#define REG_T6 31 // 同上
+
+void fold_consts(Node *func);
+
+IRFunc *gen_ir(Node *func);
+bool ir_is_compare_branch(IR *ir);
+bool ir_is_terminator(IR *ir);
+int ir_num_succs(BB *bb);
+BB *ir_succ(BB *bb, int i);
+char *ir_kind_to_str(IRKind kind);
+void ir_dump(IRFunc *fn);
+
+void eliminate_common_subexprs(IRFunc *fn);
+void optimize_loops(IRFunc *fn);
+void reduce_strength(IRFunc *fn);
+void eliminate_dead_code(IRFunc *fn);
+
+void compute_liveness(IRFunc *fn);
+void regalloc(IRFunc *fn);
+
+// codegen が出力する RISC-V の命令。関数ごとにためておき、
+// peephole で書きかえてから出力する
+typedef enum {
+  INST_RRR,      // op rd, rs1, rs2
+  INST_RRI,      // op rd, rs1, imm
+  INST_RR,       // op rd, rs1
+  INST_LI,       // li rd, imm
+  INST_LOAD,     // op rd, imm(rs1)
+  INST_STORE,    // op rs2, imm(rs1)
+  INST_LUI,      // lui rd, %hi(sym)
+  INST_ADDI_LO,  // addi rd, rs1, %lo(sym)
+  INST_LOAD_LO,  // op rd, %lo(sym)(rs1)
+  INST_STORE_LO, // op rs2, %lo(sym)(rs1)
+  INST_BRANCH,   // op rs1, .Lbb<imm> または op rs1, rs2, .Lbb<imm>
+  INST_JUMP,     // j .Lbb<imm>
+  INST_JUMP_REG, // jr rs1
+  INST_CALL,     // call sym
+  INST_RET,      // ret
+  INST_TAIL,     // tail sym
+  INST_LABEL,    // .Lbb<imm>:
+  INST_TEXT,     // sym をそのまま出力する (コメントなど)
+  INST_VEC,      // sym をそのまま出力するベクトル命令。rd, rs1, rs2 は
+                 // 読み書きする x レジスタ
+  INST_NOP,      // peephole で消したもの。何も出力しない
+} InstKind;
+
+typedef struct Inst Inst;
+struct Inst {
+  InstKind kind;
+  char *op;
+  int rd; // 使わないときは -1。rs1, rs2 も同じ
+  int rs1;
+  int rs2;
+  int imm; // 即値、オフセット、ラベルの番号
+  char *sym;
+};
+
+void peephole(List *insts);
+void schedule(List *insts);
+
+extern List *code;          // of Node *
+extern List *strings;       // of String *
+extern List *funcs;         // of Func *
+extern List *func_syms;     // of Func *, funcs を名前の番号から引く
+extern List *globals;       // of Var *
+extern List *global_syms;   // of Var *, globals を名前の番号から引く
+extern List *constants;     // of Var *
+extern List *constant_syms; // of Var *, constants を名前の番号から引く
\ No newline at end of file
@@ -0,0 +1,629 @@
+// IR の最適化
+//
+// gen_ir が作った IR を、ループの最適化の前後で書きかえる。
+//   - 同じ値を二度計算しない (eliminate_common_subexprs)
+//   - 定数による乗除算をシフトなどにする (reduce_strength)
+//   - 結果を使わない命令や読まない変数へのストアを消す (eliminate_dead_code)
+
+#include "mocc.h"
+
+static IRFunc *opt_fn;
+static int *opt_num_defs; // 仮想レジスタの番号ごとの定義の数
+static IR **opt_def_ir;
+static List *opt_irs; // of IR *, 書きかえたあとのブロックの命令
+
+static Reg *opt_new_reg() {
+  Reg *reg = arena_calloc(codegen_arena, 1, sizeof(Reg));
+  reg->vn = opt_fn->regs->len;
+  reg->rn = -1;
+  reg->hint = -1;
+  list_append(opt_fn->regs, reg);
+  return reg;
+}
+
+static IR *opt_emit(IRKind kind, Reg *d, Reg *a, Reg *b) {
+  IR *ir = arena_calloc(codegen_arena, 1, sizeof(IR));
+  ir->kind = kind;
+  ir->d = d;
+  ir->a = a;
+  ir->b = b;
+  list_append(opt_irs, ir);
+  return ir;
+}
+
+static void count_defs(IRFunc *fn) {
+  opt_fn = fn;
+  opt_num_defs = arena_calloc(codegen_arena, fn->regs->len, sizeof(int));
+  opt_def_ir = arena_calloc(codegen_arena, fn->regs->len, sizeof(IR *));
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->d != NULL) {
+        opt_num_defs[ir->d->vn]++;
+        opt_def_ir[ir->d->vn] = ir;
+      }
+    }
+  }
+}
+
+// 一度しか書かれない一時レジスタか
+static bool is_single_def(Reg *reg) {
+  return reg->var == NULL && opt_num_defs[reg->vn] == 1;
+}
+
+// 一度しか書かれない IR_IMM の値なら true を返して *val に入れる
+static bool get_const(Reg *reg, int *val) {
+  if (!is_single_def(reg)) {
+    return false;
+  }
+  IR *def = opt_def_ir[reg->vn];
+  if (def->kind != IR_IMM) {
+    return false;
+  }
+  *val = def->imm;
+  return true;
+}
+
+// 共通部分式の削除
+//
+// 基本ブロックの頭から計算した値を覚えておき (局所的な値番号づけ)、
+// 同じ命令で同じオペランドのものがまた出てきたら前の結果を使う。
+// 先行ブロックがひとつだけのブロックは、その終わりで覚えていたものを
+// 引きついで始める。こうすると && や || で分かれた条件の中でも使える。
+//
+// 覚えるのは一度しか書かれない一時レジスタに結果を置く命令だけなので、
+// 消した命令の結果の使用は、関数全体で前の結果に置きかえてよい。
+// 変数を置いたレジスタに書いたら、それを読む命令は忘れる。
+// ロードは、同じ場所を指しているかもしれないストアや関数呼び出しで忘れる
+
+static Reg **cse_repl; // 仮想レジスタの番号ごとの置きかえ先
+
+// オペランドが同じなら同じ値になる命令。ロードはメモリが書かれるまで
+static bool is_value_ir(IR *ir) {
+  switch (ir->kind) {
+  case IR_ADD:
+  case IR_ADDI:
+  case IR_SLLI:
+  case IR_SRAI:
+  case IR_SRLI:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_LT:
+  case IR_GE:
+  case IR_EQ:
+  case IR_NE:
+  case IR_AND:
+  case IR_OR:
+  case IR_NOT:
+  case IR_BOOL:
+  case IR_SEXT:
+  case IR_LADDR:
+  case IR_GADDR:
+  case IR_SADDR:
+  case IR_LOAD:
+    return true;
+  }
+  return false;
+}
+
+static bool is_commutative_ir(IRKind kind) {
+  return kind == IR_ADD || kind == IR_MUL || kind == IR_EQ || kind == IR_NE ||
+         kind == IR_AND || kind == IR_OR;
+}
+
+// 定数は使うところごとに IR_IMM があるので、値で比べる
+static bool same_operand(Reg *x, Reg *y) {
+  if (x == y) {
+    return true;
+  }
+  int vx;
+  int vy;
+  if (x == NULL || y == NULL || !get_const(x, &vx) || !get_const(y, &vy)) {
+    return false;
+  }
+  return vx == vy;
+}
+
+static bool same_expr(IR *x, IR *y) {
+  if (x->kind != y->kind || x->imm != y->imm || x->size != y->size ||
+      x->lvar != y->lvar || x->gvar != y->gvar) {
+    return false;
+  }
+  if (same_operand(x->a, y->a) && same_operand(x->b, y->b)) {
+    return true;
+  }
+  return is_commutative_ir(x->kind) && same_operand(x->a, y->b) &&
+         same_operand(x->b, y->a);
+}
+
+static Reg *cse_resolve(Reg *reg) {
+  if (reg == NULL) {
+    return NULL;
+  }
+  while (cse_repl[reg->vn] != NULL) {
+    reg = cse_repl[reg->vn];
+  }
+  return reg;
+}
+
+static void cse_rewrite_uses(IR *ir) {
+  ir->a = cse_resolve(ir->a);
+  ir->b = cse_resolve(ir->b);
+  if (ir->args != NULL) {
+    for (int k = 0; k < ir->args->len; k++) {
+      ir->args->data[k] = cse_resolve(ir->args->data[k]);
+    }
+  }
+}
+
+// ir が書くメモリを読んでいるかもしれないロードか
+static bool may_clobber(IR *ir, IR *load) {
+  if (ir->kind != IR_STORE) {
+    return true;
+  }
+  if (ir->a != NULL || load->a != NULL) {
+    return true;
+  }
+  return ir->lvar == load->lvar && ir->gvar == load->gvar;
+}
+
+// ir を実行したあとも使える命令だけを残す
+static List *cse_kill(List *avail, IR *ir) {
+  bool writes_mem = ir->kind == IR_STORE || ir->kind == IR_VSTORE ||
+                    ir->kind == IR_CALL || ir->kind == IR_VASTART;
+  Reg *var = NULL;
+  if (ir->d != NULL && ir->d->var != NULL) {
+    var = ir->d;
+  }
+  if (!writes_mem && var == NULL) {
+    return avail;
+  }
+
+  List *kept = list_new();
+  for (int i = 0; i < avail->len; i++) {
+    IR *e = avail->data[i];
+    if (var != NULL && (e->a == var || e->b == var)) {
+      continue;
+    }
+    if (writes_mem && e->kind == IR_LOAD && may_clobber(ir, e)) {
+      continue;
+    }
+    list_append(kept, e);
+  }
+  return kept;
+}
+
+static List *cse_block(BB *bb, List *avail) {
+  List *irs = list_new();
+  for (int i = 0; i < bb->irs->len; i++) {
+    IR *ir = bb->irs->data[i];
+    cse_rewrite_uses(ir);
+
+    bool reusable = is_value_ir(ir) && is_single_def(ir->d);
+    if (reusable) {
+      IR *prev = NULL;
+      for (int j = 0; j < avail->len && prev == NULL; j++) {
+        if (same_expr(avail->data[j], ir)) {
+          prev = avail->data[j];
+        }
+      }
+      if (prev != NULL) {
+        cse_repl[ir->d->vn] = prev->d;
+        continue;
+      }
+    }
+
+    list_append(irs, ir);
+    avail = cse_kill(avail, ir);
+    if (reusable) {
+      list_append(avail, ir);
+    }
+  }
+  bb->irs = irs;
+  return avail;
+}
+
+void eliminate_common_subexprs(IRFunc *fn) {
+  count_defs(fn);
+  cse_repl = arena_calloc(codegen_arena, fn->regs->len, sizeof(Reg *));
+
+  // ブロックごとの先行ブロックの数と、ひとつならその位置
+  int n = fn->bbs->len;
+  int *num_preds = arena_calloc(codegen_arena, n, sizeof(int));
+  int *pred = arena_calloc(codegen_arena, n, sizeof(int));
+  for (int i = 0; i < n; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < ir_num_succs(bb); j++) {
+      BB *succ = ir_succ(bb, j);
+      for (int k = 0; k < n; k++) {
+        if (fn->bbs->data[k] == succ) {
+          num_preds[k]++;
+          pred[k] = i;
+        }
+      }
+    }
+  }
+
+  List *outs = list_new(); // of List *, ブロックの終わりで覚えているもの
+  for (int i = 0; i < n; i++) {
+    List *avail = list_new();
+    if (num_preds[i] == 1 && pred[i] < i) {
+      list_concat(avail, outs->data[pred[i]]);
+    }
+    list_append(outs, cse_block(fn->bbs->data[i], avail));
+  }
+
+  // 後ろのブロックから前のブロックに戻る辺の先でも置きかえる
+  for (int i = 0; i < n; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      cse_rewrite_uses(bb->irs->data[j]);
+    }
+  }
+}
+
+// 定数による乗除算の軽減
+//
+// optimize_loops のあと、定数をかける IR_MUL と定数で割る IR_DIV を
+// シフトと加減算に置きかえる。ループの最適化は base + i * 定数 の形の
+// IR_MUL を探すので、それが終わってから書きかえる。
+//   - 2^k, 2^k + 1, 2^k - 1 をかけるのは、シフトとひとつの加減算にする
+//   - 2^k で割るのは、負の数を 0 の方に丸めるための補正をしてからシフトする
+//   - それ以外の定数 c で割るのは、2^p / c を切り上げた M をかけて p だけ
+//     右にシフトする。負の数なら 1 を足して 0 の方に丸める
+//
+// M をかける割り算は 32 ビットの int の範囲の値だけで正しいので、先に
+// 符号拡張しておく。M は 64 ビットのかけ算で桁あふれしないように 2^32 未満に
+// とり、2^31 以上になるなら M - 2^32 をかけてから x * 2^32 を足す。
+// 2^p は int に収まらないので、M は 16 ビットずつに分けて求める。
+
+// これより大きい定数での割り算はそのまま div にする。2^p / c を 1 ビット
+// ずつ求めるときの余りの 2 倍が int に収まる範囲
+#define MAX_MAGIC_DIVISOR 1073741824
+
+// d = a op imm のシフトを出力する
+static void opt_emit_shift(IRKind kind, Reg *d, Reg *a, int imm) {
+  IR *ir = opt_emit(kind, d, a, NULL);
+  ir->imm = imm;
+}
+
+// a op imm のシフトを新しいレジスタに出力する
+static Reg *opt_shift(IRKind kind, Reg *a, int imm) {
+  Reg *d = opt_new_reg();
+  opt_emit_shift(kind, d, a, imm);
+  return d;
+}
+
+// d = x * c を出力する。できなければ false
+static bool lower_mul(Reg *d, Reg *x, int c) {
+  if (c == 1) {
+    opt_emit(IR_MOV, d, x, NULL);
+    return true;
+  }
+
+  int k = exact_log2(c);
+  if (k > 0) {
+    opt_emit_shift(IR_SLLI, d, x, k);
+    return true;
+  }
+
+  // 2^k + 1 倍と 2^k - 1 倍
+  k = exact_log2(c - 1);
+  if (k > 0) {
+    opt_emit(IR_ADD, d, opt_shift(IR_SLLI, x, k), x);
+    return true;
+  }
+  k = exact_log2(c + 1);
+  if (k > 1) {
+    opt_emit(IR_SUB, d, opt_shift(IR_SLLI, x, k), x);
+    return true;
+  }
+  return false;
+}
+
+// 2^p / c を 1 ビットずつ割って、商を hi * 65536 + lo、余りを *rem に入れる
+static void divide_pow2(int p, int c, int *hi, int *lo, int *rem) {
+  int r = 0;
+  int h = 0;
+  int l = 0;
+  for (int i = p; i >= 0; i--) {
+    r = r * 2;
+    if (i == p) {
+      r = 1;
+    }
+    int bit = 0;
+    if (r >= c) {
+      r -= c;
+      bit = 1;
+    }
+    h = h * 2;
+    l = l * 2 + bit;
+    if (l >= 65536) {
+      l -= 65536;
+      h++;
+    }
+  }
+  *hi = h;
+  *lo = l;
+  *rem = r;
+}
+
+// d = x / c を出力する。c は 2 以上
+static void lower_div_pos(Reg *d, Reg *x, int c) {
+  int k = exact_log2(c);
+  if (k > 0) {
+    // 負の数なら 2^k - 1 を足してから算術シフトすると 0 の方に丸まる
+    Reg *sign = opt_shift(IR_SRAI, x, 63);
+    Reg *t = opt_new_reg();
+    opt_emit(IR_ADD, t, x, opt_shift(IR_SRLI, sign, 64 - k));
+    opt_emit_shift(IR_SRAI, d, t, k);
+    return;
+  }
+
+  // c <= 2^L となる最小の L
+  int l = 0;
+  int pow = 1;
+  while (pow < c) {
+    pow *= 2;
+    l++;
+  }
+
+  // M = 2^p / c の切り上げ、誤差 e = M * c - 2^p のとき、|x| <= 2^31 で
+  // x * e < 2^p なら正しく割れる。p = 30 + L で e < 2^(L-1) なら M < 2^31。
+  // だめなら p = 31 + L にすれば e < c <= 2^L で、M は 2^31 以上 2^32 未満
+  int p = 30 + l;
+  int hi;
+  int lo;
+  int rem;
+  divide_pow2(p, c, &hi, &lo, &rem);
+  if (rem != 0 && c - rem >= pow / 2) {
+    p++;
+    divide_pow2(p, c, &hi, &lo, &rem);
+  }
+  if (rem != 0) {
+    lo++;
+    if (lo == 65536) {
+      lo = 0;
+      hi++;
+    }
+  }
+
+  bool big = hi >= 32768;
+  if (big) {
+    hi -= 65536;
+  }
+
+  Reg *s = opt_new_reg();
+  IR *sext = opt_emit(IR_SEXT, s, x, NULL);
+  sext->size = 4;
+  Reg *m = opt_new_reg();
+  IR *imm = opt_emit(IR_IMM, m, NULL, NULL);
+  imm->imm = hi * 65536 + lo;
+  Reg *prod = opt_new_reg();
+  opt_emit(IR_MUL, prod, s, m);
+  if (big) {
+    Reg *t = opt_new_reg();
+    opt_emit(IR_ADD, t, prod, opt_shift(IR_SLLI, s, 32));
+    prod = t;
+  }
+  Reg *q = opt_shift(IR_SRAI, prod, p);
+  opt_emit(IR_ADD, d, q, opt_shift(IR_SRLI, s, 63));
+}
+
+// d = x / c を出力する。できなければ false
+static bool lower_div(Reg *d, Reg *x, int c) {
+  if (c == 1) {
+    opt_emit(IR_MOV, d, x, NULL);
+    return true;
+  }
+
+  if (2 <= c && c <= MAX_MAGIC_DIVISOR) {
+    lower_div_pos(d, x, c);
+    return true;
+  }
+  if (0 - MAX_MAGIC_DIVISOR <= c && c <= -2) {
+    Reg *q = opt_new_reg();
+    lower_div_pos(q, x, 0 - c);
+    Reg *zero = opt_new_reg();
+    opt_emit(IR_IMM, zero, NULL, NULL);
+    opt_emit(IR_SUB, d, zero, q);
+    return true;
+  }
+  return false;
+}
+
+static bool lower_ir(IR *ir) {
+  int c;
+  if (ir->kind == IR_MUL) {
+    if (get_const(ir->b, &c) && lower_mul(ir->d, ir->a, c)) {
+      return true;
+    }
+    return get_const(ir->a, &c) && lower_mul(ir->d, ir->b, c);
+  }
+  if (ir->kind == IR_DIV) {
+    return get_const(ir->b, &c) && lower_div(ir->d, ir->a, c);
+  }
+  return false;
+}
+
+void reduce_strength(IRFunc *fn) {
+  count_defs(fn);
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    opt_irs = list_new();
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (!lower_ir(ir)) {
+        list_append(opt_irs, ir);
+      }
+    }
+    bb->irs = opt_irs;
+  }
+}
+
+// 不要なコードの削除
+//
+// まず、関数呼び出しやストア、分岐のように消せない命令から、読んでいる
+// レジスタを書く命令をたどって印をつけ、印のない命令を消す。IR_V* は
+// ベクトルレジスタを追っていないので、これも消せない命令にする。
+// 次にブロックをまたぐ生存解析をして、変数を置いたレジスタへの書きこみで
+// そのあと読まれないものを、それが読んでいた値の計算といっしょに消す。
+//
+// フレーム上の変数で、アドレスをとらず一度も読まないものへのストアも消す。
+// 命令から参照されなくなった変数は、codegen がフレームに場所をとらない
+
+static bool is_removable_ir(IR *ir) {
+  return ir->kind == IR_IMM || ir->kind == IR_MOV || is_value_ir(ir);
+}
+
+static bool dce_contains(List *list, void *data) {
+  for (int i = 0; i < list->len; i++) {
+    if (list->data[i] == data) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 読まれないフレーム上の変数へのストアを消す
+static void remove_dead_stores(IRFunc *fn) {
+  List *read_vars = list_new(); // of Var *
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->lvar != NULL && ir->kind != IR_STORE &&
+          !dce_contains(read_vars, ir->lvar)) {
+        list_append(read_vars, ir->lvar);
+      }
+    }
+  }
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    List *irs = list_new();
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind == IR_STORE && ir->lvar != NULL &&
+          !dce_contains(read_vars, ir->lvar)) {
+        continue;
+      }
+      list_append(irs, ir);
+    }
+    bb->irs = irs;
+  }
+}
+
+static void mark_reg_defs(List *work, List **defs, Reg *reg) {
+  if (reg == NULL || defs[reg->vn] == NULL) {
+    return;
+  }
+  list_concat(work, defs[reg->vn]);
+  defs[reg->vn] = NULL;
+}
+
+// 消せない命令が使う値を計算する命令だけを残す
+static void remove_unused_irs(IRFunc *fn) {
+  // of IR *
+  List **defs = arena_calloc(codegen_arena, fn->regs->len, sizeof(List *));
+  List *work = list_new(); // of IR *
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (!is_removable_ir(ir)) {
+        list_append(work, ir);
+      } else {
+        if (defs[ir->d->vn] == NULL) {
+          defs[ir->d->vn] = list_new();
+        }
+        list_append(defs[ir->d->vn], ir);
+      }
+    }
+  }
+
+  // 残す命令が読むレジスタの定義をたどる。たどった定義は defs から外す
+  while (work->len > 0) {
+    work->len--;
+    IR *ir = work->data[work->len];
+    mark_reg_defs(work, defs, ir->a);
+    mark_reg_defs(work, defs, ir->b);
+    if (ir->args != NULL) {
+      for (int k = 0; k < ir->args->len; k++) {
+        mark_reg_defs(work, defs, ir->args->data[k]);
+      }
+    }
+  }
+
+  // defs に残っているのは、どこからも読まれない定義
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    List *irs = list_new();
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      if (is_removable_ir(ir) && defs[ir->d->vn] != NULL) {
+        continue;
+      }
+      list_append(irs, ir);
+    }
+    bb->irs = irs;
+  }
+}
+
+// ブロックを後ろから見て、結果が生きていない命令を消す
+static void remove_dead_irs(BB *bb, int nregs) {
+  char *live = arena_calloc(codegen_arena, nregs + 1, 1);
+  for (int r = 0; r < nregs; r++) {
+    live[r] = bb->live_out[r];
+  }
+
+  char *dead = arena_calloc(codegen_arena, bb->irs->len + 1, 1);
+  bool changed = false;
+  for (int j = bb->irs->len - 1; j >= 0; j--) {
+    IR *ir = bb->irs->data[j];
+    if (ir->d != NULL && !live[ir->d->vn] && is_removable_ir(ir)) {
+      dead[j] = 1;
+      changed = true;
+      continue;
+    }
+
+    if (ir->d != NULL) {
+      live[ir->d->vn] = 0;
+    }
+    if (ir->a != NULL) {
+      live[ir->a->vn] = 1;
+    }
+    if (ir->b != NULL) {
+      live[ir->b->vn] = 1;
+    }
+    if (ir->args != NULL) {
+      for (int k = 0; k < ir->args->len; k++) {
+        Reg *arg = ir->args->data[k];
+        live[arg->vn] = 1;
+      }
+    }
+  }
+
+  if (changed) {
+    List *irs = list_new();
+    for (int j = 0; j < bb->irs->len; j++) {
+      if (!dead[j]) {
+        list_append(irs, bb->irs->data[j]);
+      }
+    }
+    bb->irs = irs;
+  }
+}
+
+void eliminate_dead_code(IRFunc *fn) {
+  remove_dead_stores(fn);
+  remove_unused_irs(fn);
+
+  compute_liveness(fn);
+  for (int i = 0; i < fn->bbs->len; i++) {
+    remove_dead_irs(fn->bbs->data[i], fn->regs->len);
+  }
+}
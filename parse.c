@@ -21,15 +21,15 @@ char *node_kind_to_str(NodeKind kind) {
 }
 
 Node *new_node(NodeKind kind, Node *lhs, Node *rhs) {
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
   node->kind = kind;
   node->lhs = lhs;
   node->rhs = rhs;
-  node->source_pos = prev_token->str;
+  node->source_pos = token_str(token_peek(-1));
   return node;
 }
 
-static Node *new_node_num(int val) {
+Node *new_node_num(int val) {
   Node *node = new_node(ND_NUM, NULL, NULL);
   node->val = val;
   return node;
@@ -89,18 +89,46 @@ static Node *parse_assign();
 Scope *curr_scope;
 int scope_id = 0;
 
-static Var *find_var_in_curr_scope(char *name, int len) {
-  for (Scope *scope = curr_scope; scope; scope = scope->parent) {
-    for (int i = 0; i < scope->node->locals->len; i++) {
-      Var *var = scope->node->locals->data[i];
-      if (var->scope_id == scope->id && var->len == len &&
-          strncmp(var->name, name, len) == 0) {
-        return var;
-      }
-    }
+// 名前の番号から、今のスコープで見えているローカル変数を引く表
+static List *local_syms; // of Var *
+
+// local_syms の書きかえの記録。スコープを抜けるときに新しいほうから戻す
+typedef struct LocalUndo LocalUndo;
+struct LocalUndo {
+  int sym;
+  Var *prev; // 書きかえる前に見えていた変数
+};
+static List *local_undo; // of LocalUndo *
+
+static Var *find_var_in_curr_scope(int sym) {
+  return sym_lookup(local_syms, sym);
+}
+
+// 今のスコープにローカル変数を加える
+static Var *declare_lvar(Token *tok, Type *type) {
+  Var *prev = sym_lookup(local_syms, tok->sym);
+  if (prev != NULL && prev->scope_id == curr_scope->id) {
+    error("variable already defined: '%.*s'", tok->len, token_str(tok));
   }
 
-  return NULL;
+  Var *var = add_lvar(curr_scope->node->locals, token_str(tok), tok->len, type,
+                      curr_scope->id);
+
+  LocalUndo *undo = arena_calloc(ast_arena, 1, sizeof(LocalUndo));
+  undo->sym = tok->sym;
+  undo->prev = prev;
+  list_append(local_undo, undo);
+  sym_assign(local_syms, tok->sym, var);
+  return var;
+}
+
+// スコープの中で加えた変数を見えなくする
+static void unbind_scope_vars(Scope *scope) {
+  while (local_undo->len > scope->undo_len) {
+    local_undo->len--;
+    LocalUndo *undo = local_undo->data[local_undo->len];
+    sym_assign(local_syms, undo->sym, undo->prev);
+  }
 }
 
 static int scope_offset(Scope *scope) {
@@ -115,22 +143,35 @@ static int scope_offset(Scope *scope) {
 static void scope_create(Node *node) {
   node->locals = list_new();
 
-  Scope *scope = calloc(1, sizeof(Scope));
+  if (local_syms == NULL) {
+    local_syms = list_new();
+    local_undo = list_new();
+  }
+
+  Scope *scope = arena_calloc(ast_arena, 1, sizeof(Scope));
   scope->node = node;
   scope->id = ++scope_id;
+  scope->undo_len = local_undo->len;
   curr_scope = scope;
 }
 
+// 関数のスコープを抜ける
+static void scope_close() {
+  unbind_scope_vars(curr_scope);
+  curr_scope = NULL;
+}
+
 static void scope_push(Node *node) {
   assert(curr_scope != NULL);
   assert(node->locals == NULL);
 
   node->locals = list_new();
 
-  Scope *scope = calloc(1, sizeof(Scope));
+  Scope *scope = arena_calloc(ast_arena, 1, sizeof(Scope));
   scope->node = node;
   scope->parent = curr_scope;
   scope->id = ++scope_id;
+  scope->undo_len = local_undo->len;
   curr_scope = scope;
 }
 
@@ -138,6 +179,8 @@ static void scope_pop() {
   Scope *parent = curr_scope->parent;
   assert(parent != NULL);
 
+  unbind_scope_vars(curr_scope);
+
   // このスコープに定義された変数を親スコープにマージする
   int offset = scope_offset(parent);
   for (int i = 0; i < curr_scope->node->locals->len; i++) {
@@ -174,28 +217,20 @@ static Node *parse_primary() {
     if (token_consume_punct("(")) {
       // 関数呼び出しだった
 
-      Node *node = calloc(1, sizeof(Node));
+      Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
       node->kind = ND_CALL;
       node->ident = tok;
-      node->source_pos = tok->str;
+      node->source_pos = token_str(tok);
       node->source_len = tok->len;
 
       __debug_self("ND_CALL");
-      Func *func = NULL;
-      for (int i = 0; i < funcs->len; i++) {
-        Func *f = funcs->data[i];
-        if (f->name_len == tok->len &&
-            strncmp(f->name, tok->str, tok->len) == 0) {
-          func = f;
-          break;
-        }
-      }
+      Func *func = sym_lookup(func_syms, tok->sym);
 
       if (func == NULL) {
-        if (tok->len == 8 && strncmp(tok->str, "va_start", 8) == 0) {
+        if (tok->len == 8 && strncmp(token_str(tok), "va_start", 8) == 0) {
           node->type = &void_type;
         } else {
-          error("function is not defined: %.*s", tok->len, tok->str);
+          error("function is not defined: %.*s", tok->len, token_str(tok));
         }
       } else {
         node->type = func->type;
@@ -218,12 +253,12 @@ static Node *parse_primary() {
       return node;
     }
 
-    Var *lvar = find_var_in_curr_scope(tok->str, tok->len);
+    Var *lvar = find_var_in_curr_scope(tok->sym);
     if (lvar) {
-      Node *node = calloc(1, sizeof(Node));
+      Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
       node->kind = ND_LVAR;
       node->lvar = lvar;
-      node->source_pos = tok->str;
+      node->source_pos = token_str(tok);
       node->source_len = tok->len;
 
       // ここで生の配列を見つけた場合は &a を返す、というコードを書いていたが
@@ -234,36 +269,36 @@ static Node *parse_primary() {
       return node;
     }
 
-    Var *gvar = find_var(globals, tok->str, tok->len);
+    Var *gvar = sym_lookup(global_syms, tok->sym);
     if (gvar) {
-      Node *node = calloc(1, sizeof(Node));
+      Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
       node->kind = ND_GVAR;
       node->gvar = gvar;
-      node->source_pos = tok->str;
+      node->source_pos = token_str(tok);
       node->source_len = tok->len;
       return node;
     }
 
-    Var *cvar = find_var(constants, tok->str, tok->len);
+    Var *cvar = sym_lookup(constant_syms, tok->sym);
     if (cvar) {
       return cvar->const_val;
     }
 
-    error("variable not found: '%.*s'", tok->len, tok->str);
+    error("variable not found: '%.*s'", tok->len, token_str(tok));
   }
 
   Token *tok_str = token_consume(TK_STRING);
   if (tok_str) {
-    String *str = calloc(1, sizeof(String));
-    str->str = tok_str->str;
+    String *str = arena_calloc(ast_arena, 1, sizeof(String));
+    str->str = token_str(tok_str);
     str->len = tok_str->len;
 
     int n = list_append(strings, str);
 
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_STRING;
     node->val = n;
-    node->source_pos = tok_str->str;
+    node->source_pos = token_str(tok_str);
     node->source_len = tok_str->len;
     return node;
   }
@@ -277,14 +312,14 @@ static Node *parse_primary() {
 }
 
 static Type *new_type_ptr_to(Type *base) {
-  Type *type = calloc(1, sizeof(Type));
+  Type *type = arena_calloc(type_arena, 1, sizeof(Type));
   type->ty = TY_PTR;
   type->base = base;
   return type;
 }
 
 static Type *new_type_array_of(Type *base, int size) {
-  Type *type = calloc(1, sizeof(Type));
+  Type *type = arena_calloc(type_arena, 1, sizeof(Type));
   type->ty = TY_ARRAY;
   type->base = base;
   type->array_size = size;
@@ -372,7 +407,8 @@ Type *typeof_node(Node *node) {
       error_at(node->source_pos, "not a struct");
     }
 
-    Var *member = find_var(stype->members, node->ident->str, node->ident->len);
+    Var *member =
+        find_var(stype->members, token_str(node->ident), node->ident->len);
     Type *type = member->type;
     if (type->ty == TY_TYPEDEF) {
       return type->base;
@@ -660,10 +696,10 @@ Node *parse_stmt();
 
 Node *parse_block() {
   if (token_consume_punct("{")) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_BLOCK;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     // FIXME: 関数宣言の場合はスコープを作らないなどしたい (see test.sh)
     scope_push(node);
@@ -684,7 +720,7 @@ Node *parse_block() {
 }
 
 Type *parse_type() {
-  Type *type = calloc(1, sizeof(Type));
+  Type *type = arena_calloc(type_arena, 1, sizeof(Type));
 
   if (token_consume_type("int")) {
     type->ty = TY_INT;
@@ -697,7 +733,7 @@ Type *parse_type() {
 
     Token *name = token_consume(TK_IDENT);
     if (name != NULL) {
-      type->name = name->str;
+      type->name = token_str(name);
       type->name_len = name->len;
     }
 
@@ -716,8 +752,9 @@ Type *parse_type() {
           error("expected member name");
         }
 
-        add_var(type->members, member_name->str, member_name->len, member_type,
-                /* is_extern */ false, /* is_struct_member */ true, -1);
+        add_var(type->members, token_str(member_name), member_name->len,
+                member_type, /* is_extern */ false,
+                /* is_struct_member */ true, -1);
 
         token_expect_punct(";");
 
@@ -742,7 +779,7 @@ Type *parse_type() {
 
     Token *name = token_consume(TK_IDENT);
     if (name != NULL) {
-      type->name = name->str;
+      type->name = token_str(name);
       type->name_len = name->len;
       type = add_or_find_defined_type(type);
     }
@@ -763,9 +800,10 @@ Type *parse_type() {
         }
 
         Var *var =
-            add_var(constants, enum_item->str, enum_item->len, type,
+            add_var(constants, token_str(enum_item), enum_item->len, type,
                     /* is_extern */ false, /* is_struct_member */ false, -1);
         var->const_val = new_node_num(i);
+        sym_define(constant_syms, enum_item->sym, var);
 
         if (token_consume_punct("}")) {
           break;
@@ -780,11 +818,12 @@ Type *parse_type() {
     // typedef の場合は空の宣言がないので add_defined_type がよいのではないか
     return type;
   } else {
-    if (curr_token->kind != TK_IDENT) {
+    if (token_peek(0)->kind != TK_IDENT) {
       return NULL;
     }
-    __debug_self("find_defined_type: %.*s", curr_token->len, curr_token->str);
-    type = find_defined_type(curr_token->str, curr_token->len);
+    __debug_self("find_defined_type: %.*s", token_peek(0)->len,
+                 token_str(token_peek(0)));
+    type = find_defined_type(token_peek(0)->sym);
     if (type == NULL) {
       return NULL;
     }
@@ -801,7 +840,7 @@ Type *parse_type() {
   }
 
   while (token_consume_punct("*")) {
-    Type *type_p = calloc(1, sizeof(Type));
+    Type *type_p = arena_calloc(type_arena, 1, sizeof(Type));
     type_p->ty = TY_PTR;
     type_p->base = type;
 
@@ -849,14 +888,12 @@ static Node *parse_vardecl() {
     type = new_type_array_of(type, size);
   }
 
-  Var *lvar = add_var(curr_scope->node->locals, tok_var->str, tok_var->len,
-                      type, /* is_extern */ false, /* is_struct_member */ false,
-                      curr_scope->id);
+  Var *lvar = declare_lvar(tok_var, type);
 
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
   node->kind = ND_VARDECL;
   node->lvar = lvar;
-  node->source_pos = tok_var->str;
+  node->source_pos = token_str(tok_var);
   node->source_len = tok_var->len;
 
   if (token_consume_punct("=")) {
@@ -909,10 +946,10 @@ static int compute_const_expr(Node *node) {
 
 Node *parse_stmt() {
   if (token_consume(TK_RETURN) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_RETURN;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
     if (token_consume_punct(";")) {
       Scope *func = scope_find(ND_FUNCDECL);
       if (func->node->type->ty != TY_VOID) {
@@ -939,7 +976,7 @@ Node *parse_stmt() {
       else_stmt = parse_stmt();
     }
 
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_IF;
     node->label_index = ++label_index;
     node->lhs = expr;
@@ -951,11 +988,11 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_SWITCH) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_SWITCH;
     node->label_index = ++label_index;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     scope_push(node);
 
@@ -970,11 +1007,11 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_WHILE) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_WHILE;
     node->label_index = ++label_index;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     scope_push(node);
 
@@ -989,11 +1026,11 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_FOR) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_FOR;
     node->label_index = ++label_index;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     scope_push(node);
 
@@ -1027,10 +1064,10 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_BREAK) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_BREAK;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     Scope *target_scope = NULL;
     for (Scope *scope = curr_scope; scope; scope = scope->parent) {
@@ -1051,10 +1088,10 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_CONTINUE) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_CONTINUE;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
 
     Scope *target_scope = NULL;
     for (Scope *scope = curr_scope; scope; scope = scope->parent) {
@@ -1073,22 +1110,22 @@ Node *parse_stmt() {
   }
 
   if (token_consume(TK_CASE) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_CASE;
     node->val = compute_const_expr(parse_expr());
     node->label_index = ++label_index;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
     token_expect_punct(":");
     return node;
   }
 
   if (token_consume(TK_DEFAULT) != NULL) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_DEFAULT;
     node->label_index = ++label_index;
-    node->source_pos = prev_token->str;
-    node->source_len = prev_token->len;
+    node->source_pos = token_str(token_peek(-1));
+    node->source_len = token_peek(-1)->len;
     token_expect_punct(":");
     return node;
   }
@@ -1128,7 +1165,7 @@ static Node *parse_decl() {
 
       // じつはここでもう処理は済んでしまっている
       // 適当に無害な Node を作って返す
-      Node *node = calloc(1, sizeof(Node));
+      Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
       node->kind = ND_NOP;
       return node;
     } else {
@@ -1141,18 +1178,18 @@ static Node *parse_decl() {
 
     // この場合だけ変数の宣言ではなく型をつくる
     // FIXME: add_defined_type のほうがいい
-    type->name = ident->str;
+    type->name = token_str(ident);
     type->name_len = ident->len;
 
     add_or_find_defined_type(type);
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
     node->kind = ND_NOP;
     return node;
   }
 
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
   node->ident = ident;
-  node->source_pos = ident->str;
+  node->source_pos = token_str(ident);
   node->source_len = ident->len;
 
   if (_parse_decl_func(node, type)) {
@@ -1198,9 +1235,10 @@ static Node *parse_decl() {
 
   token_expect_punct(";");
 
-  Var *gvar =
-      add_var(globals, ident->str, ident->len, type, is_extern, false, -1);
+  Var *gvar = add_var(globals, token_str(ident), ident->len, type, is_extern,
+                      false, -1);
   node->gvar = gvar;
+  sym_define(global_syms, ident->sym, gvar);
 
   return node;
 }
@@ -1221,7 +1259,7 @@ static bool _parse_decl_func(Node *node, Type *type) {
   } else {
     for (;;) {
       if (token_consume_punct("...")) {
-        Node *node = calloc(1, sizeof(Node));
+        Node *node = arena_calloc(ast_arena, 1, sizeof(Node));
         node->kind = ND_VARARGS;
         list_append(args, node);
         token_expect_punct(")");
@@ -1238,12 +1276,11 @@ static bool _parse_decl_func(Node *node, Type *type) {
         error("expected argument name");
       }
 
-      Node *ident = calloc(1, sizeof(Node));
+      Node *ident = arena_calloc(ast_arena, 1, sizeof(Node));
       ident->kind = ND_LVAR;
-      Var *lvar = add_var(curr_scope->node->locals, tok->str, tok->len, type,
-                          false, false, curr_scope->id);
+      Var *lvar = declare_lvar(tok, type);
       ident->lvar = lvar;
-      ident->source_pos = tok->str;
+      ident->source_pos = token_str(tok);
       ident->source_len = tok->len;
 
       list_append(args, ident);
@@ -1258,12 +1295,13 @@ static bool _parse_decl_func(Node *node, Type *type) {
 
   node->args = args;
 
-  Func *func = calloc(1, sizeof(Func));
-  func->name = node->ident->str;
+  Func *func = arena_calloc(type_arena, 1, sizeof(Func));
+  func->name = token_str(node->ident);
   func->name_len = node->ident->len;
   func->type = type;
 
   list_append(funcs, func);
+  sym_define(func_syms, node->ident->sym, func);
 
   Node *block = parse_block();
   if (!block) {
@@ -1271,12 +1309,13 @@ static bool _parse_decl_func(Node *node, Type *type) {
     token_expect_punct(";");
 
     node->kind = ND_NOP;
+    scope_close();
     return true;
   }
 
   node->nodes = block->nodes;
 
-  curr_scope = NULL;
+  scope_close();
 
   return true;
 }
@@ -1284,20 +1323,24 @@ static bool _parse_decl_func(Node *node, Type *type) {
 List *code;
 List *strings;
 List *funcs;
+List *func_syms;
 
 void parse_program() {
   code = list_new();
   strings = list_new();
   funcs = list_new();
+  func_syms = list_new();
   defined_types = list_new();
   globals = list_new();
+  global_syms = list_new();
   constants = list_new();
+  constant_syms = list_new();
 
   while (!token_at_eof()) {
     list_append(code, parse_decl());
   }
 
-  if (curr_token != NULL && curr_token->kind != TK_EOF) {
+  if (!token_at_eof()) {
     error("not all tokens are consumed");
   }
 }
\ No newline at end of file
@@ -0,0 +1,653 @@
+// のぞき穴最適化
+//
+// codegen がためた関数ひとつ分の命令列を前から順に見て、レジスタに入っている
+// 定数、32 ビットから符号拡張済みの値かどうか、0 か 1 しかとらないかどうか、
+// 直前にメモリと読み書きした値を覚えておき、もっと安い命令に書きかえる。
+// そのあと命令列の上で生存解析をして、結果が使われない命令を消す。
+// どちらもラベルをまたいだら何も知らないものとする。
+
+#include "mocc.h"
+
+static bool has_const[NUM_PHYS_REGS];
+static int const_val[NUM_PHYS_REGS];
+static bool is_sext[NUM_PHYS_REGS]; // 32 ビットの値を符号拡張したもの
+static bool is_bool[NUM_PHYS_REGS]; // 0 か 1
+
+// 直前にメモリを読み書きした命令。メモリのその場所とレジスタの値が
+// 同じであることがわかっている。NULL なら何も覚えていない
+static Inst *mem_inst;
+
+static bool is_op(Inst *inst, char *op) {
+  if (inst->op == NULL) {
+    return false;
+  }
+  if (inst->op[0] != op[0]) {
+    return false;
+  }
+  return strcmp(inst->op, op) == 0;
+}
+
+static bool is_imm12_value(int imm) {
+  return -2048 <= imm && imm <= 2047;
+}
+
+static bool is_caller_saved(int rn) {
+  return rn == REG_RA || (5 <= rn && rn <= 7) || (10 <= rn && rn <= 17) ||
+         28 <= rn;
+}
+
+// mem_inst の値が入っているレジスタ
+static int mem_value_reg() {
+  if (mem_inst->kind == INST_STORE) {
+    return mem_inst->rs2;
+  }
+  return mem_inst->rd;
+}
+
+static void forget_reg(int rn) {
+  has_const[rn] = false;
+  is_sext[rn] = false;
+  is_bool[rn] = false;
+
+  if (mem_inst != NULL) {
+    if (mem_inst->rs1 == rn || mem_value_reg() == rn) {
+      mem_inst = NULL;
+    }
+  }
+}
+
+static void forget_all() {
+  for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+    forget_reg(rn);
+  }
+  mem_inst = NULL;
+
+  // zero はいつでも 0
+  has_const[0] = true;
+  const_val[0] = 0;
+  is_sext[0] = true;
+  is_bool[0] = true;
+}
+
+static bool is_const(int rn, int val) {
+  return has_const[rn] && const_val[rn] == val;
+}
+
+static void to_rr(Inst *inst, char *op, int rs1) {
+  inst->kind = INST_RR;
+  inst->op = op;
+  inst->rs1 = rs1;
+  inst->rs2 = -1;
+}
+
+static void to_rri(Inst *inst, char *op, int rs1, int imm) {
+  inst->kind = INST_RRI;
+  inst->op = op;
+  inst->rs1 = rs1;
+  inst->rs2 = -1;
+  inst->imm = imm;
+}
+
+// rs2 が定数 val の op rd, rs1, rs2 を即値の命令にする。できなければ false
+static bool fold_rrr_imm(Inst *inst, int rs1, int val) {
+  if (is_op(inst, "mul")) {
+    if (val == 1) {
+      to_rr(inst, "mv", rs1);
+      return true;
+    }
+    int shift = exact_log2(val);
+    if (shift > 0) {
+      to_rri(inst, "slli", rs1, shift);
+      return true;
+    }
+    return false;
+  }
+
+  if (is_op(inst, "sub")) {
+    // INT_MIN は符号を反転できない
+    if (!is_imm12_value(val) || !is_imm12_value(0 - val)) {
+      return false;
+    }
+    to_rri(inst, "addi", rs1, 0 - val);
+    return true;
+  }
+
+  if (!is_imm12_value(val)) {
+    return false;
+  }
+
+  if (is_op(inst, "add")) {
+    to_rri(inst, "addi", rs1, val);
+  } else if (is_op(inst, "slt")) {
+    to_rri(inst, "slti", rs1, val);
+  } else if (is_op(inst, "and")) {
+    to_rri(inst, "andi", rs1, val);
+  } else if (is_op(inst, "or")) {
+    to_rri(inst, "ori", rs1, val);
+  } else if (is_op(inst, "xor")) {
+    to_rri(inst, "xori", rs1, val);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool is_commutative(Inst *inst) {
+  return is_op(inst, "add") || is_op(inst, "mul") || is_op(inst, "and") ||
+         is_op(inst, "or") || is_op(inst, "xor");
+}
+
+static void rewrite_rrr(Inst *inst) {
+  // 0 とわかっているレジスタは zero にしておく
+  if (is_const(inst->rs1, 0)) {
+    inst->rs1 = 0;
+  }
+  if (is_const(inst->rs2, 0)) {
+    inst->rs2 = 0;
+  }
+
+  if (has_const[inst->rs2]) {
+    if (fold_rrr_imm(inst, inst->rs1, const_val[inst->rs2])) {
+      return;
+    }
+  }
+  if (has_const[inst->rs1] && is_commutative(inst)) {
+    fold_rrr_imm(inst, inst->rs2, const_val[inst->rs1]);
+  }
+}
+
+static void rewrite_rri(Inst *inst) {
+  if (inst->imm != 0) {
+    return;
+  }
+
+  if (is_op(inst, "addi") || is_op(inst, "ori") || is_op(inst, "xori") ||
+      is_op(inst, "slli") || is_op(inst, "srai")) {
+    to_rr(inst, "mv", inst->rs1);
+  }
+}
+
+// 直前の命令 prev の結果を sext.w しているなら、32 ビット版の命令にまとめる。
+// prev の結果がほかで使われなければ、あとで prev は消える
+static bool fuse_sext(Inst *inst, Inst *prev) {
+  if (prev == NULL) {
+    return false;
+  }
+  if (prev->rd != inst->rs1 || prev->rd == prev->rs1 ||
+      prev->rd == prev->rs2) {
+    return false;
+  }
+
+  char *op = NULL;
+  if (prev->kind == INST_RRR) {
+    if (is_op(prev, "add")) {
+      op = "addw";
+    } else if (is_op(prev, "sub")) {
+      op = "subw";
+    } else if (is_op(prev, "mul")) {
+      op = "mulw";
+    } else if (is_op(prev, "div")) {
+      // 64 ビットの割り算と結果が同じになるのは、どちらも 32 ビットのとき
+      if (is_sext[prev->rs1] && is_sext[prev->rs2]) {
+        op = "divw";
+      }
+    }
+  } else if (prev->kind == INST_RRI) {
+    if (is_op(prev, "addi")) {
+      op = "addiw";
+    } else if (is_op(prev, "slli")) {
+      op = "slliw";
+    }
+  }
+  if (op == NULL) {
+    return false;
+  }
+
+  inst->kind = prev->kind;
+  inst->op = op;
+  inst->rs1 = prev->rs1;
+  inst->rs2 = prev->rs2;
+  inst->imm = prev->imm;
+  return true;
+}
+
+static void rewrite_rr(Inst *inst, Inst *prev) {
+  int rs = inst->rs1;
+
+  if (is_op(inst, "sext.w")) {
+    if (is_sext[rs]) {
+      to_rr(inst, "mv", rs);
+    } else if (fuse_sext(inst, prev)) {
+      return;
+    }
+  }
+
+  if (is_op(inst, "snez") && is_bool[rs]) {
+    to_rr(inst, "mv", rs);
+  }
+
+  if (is_op(inst, "mv")) {
+    if (rs == inst->rd) {
+      inst->kind = INST_NOP;
+      return;
+    }
+    if (rs != 0 && has_const[rs]) {
+      inst->kind = INST_LI;
+      inst->op = "li";
+      inst->rs1 = -1;
+      inst->imm = const_val[rs];
+    }
+  }
+}
+
+// mem_inst と同じ場所を同じ幅で読み書きするか
+static bool same_slot(Inst *inst, char *store_op, char *load_op) {
+  if (mem_inst == NULL) {
+    return false;
+  }
+  if (mem_inst->rs1 != inst->rs1 || mem_inst->imm != inst->imm) {
+    return false;
+  }
+  return is_op(mem_inst, store_op) || is_op(mem_inst, load_op);
+}
+
+// 直前に読み書きした場所をもう一度読むなら、レジスタから持ってくる
+static void rewrite_load(Inst *inst) {
+  if (same_slot(inst, "sd", "ld") && is_op(inst, "ld")) {
+    to_rr(inst, "mv", mem_value_reg());
+    return;
+  }
+
+  if (same_slot(inst, "sw", "lw") && is_op(inst, "lw")) {
+    int rs = mem_value_reg();
+    if (is_sext[rs]) {
+      to_rr(inst, "mv", rs);
+    } else {
+      to_rr(inst, "sext.w", rs);
+    }
+    return;
+  }
+
+  if (same_slot(inst, "lb", "lb") && is_op(inst, "lb")) {
+    to_rr(inst, "mv", mem_value_reg());
+  }
+}
+
+static void rewrite_store(Inst *inst) {
+  if (is_const(inst->rs2, 0)) {
+    inst->rs2 = 0;
+  }
+
+  // 同じ値がすでに入っている
+  if (same_slot(inst, "sd", "ld") && is_op(inst, "sd")) {
+    if (mem_value_reg() == inst->rs2) {
+      inst->kind = INST_NOP;
+      return;
+    }
+  }
+  if (same_slot(inst, "sw", "lw") && is_op(inst, "sw")) {
+    if (mem_value_reg() == inst->rs2) {
+      inst->kind = INST_NOP;
+      return;
+    }
+  }
+
+  // どこを指しているかわからないので、ほかに覚えていたものは忘れる
+  mem_inst = NULL;
+  if (is_op(inst, "sd") || is_op(inst, "sw")) {
+    mem_inst = inst;
+  }
+}
+
+// inst が rd に書く値について、わかることを覚える
+static void note_def(Inst *inst) {
+  int rd = inst->rd;
+  if (rd <= 0) {
+    return;
+  }
+
+  int rs1 = inst->rs1;
+  int rs2 = inst->rs2;
+  bool c = false;
+  int val = 0;
+  bool sx = false;
+  bool bl = false;
+
+  switch (inst->kind) {
+  case INST_LI:
+    c = true;
+    val = inst->imm;
+    sx = true;
+    bl = val == 0 || val == 1;
+    break;
+  case INST_RR:
+    if (is_op(inst, "mv")) {
+      c = has_const[rs1];
+      val = const_val[rs1];
+      sx = is_sext[rs1];
+      bl = is_bool[rs1];
+    } else if (is_op(inst, "sext.w")) {
+      sx = true;
+      bl = is_bool[rs1];
+    } else {
+      // seqz, snez
+      sx = true;
+      bl = true;
+    }
+    break;
+  case INST_RRI:
+    if (is_op(inst, "slti")) {
+      sx = true;
+      bl = true;
+    } else if (is_op(inst, "xori") || is_op(inst, "ori")) {
+      sx = is_sext[rs1];
+      bl = is_bool[rs1] && (inst->imm == 0 || inst->imm == 1);
+    } else if (is_op(inst, "andi")) {
+      sx = is_sext[rs1];
+      bl = is_bool[rs1] || inst->imm == 1;
+    } else if (is_op(inst, "srai")) {
+      sx = is_sext[rs1] || inst->imm >= 32;
+    } else if (is_op(inst, "srli")) {
+      sx = inst->imm >= 33;
+      bl = inst->imm == 63;
+    } else if (is_op(inst, "addiw") || is_op(inst, "slliw")) {
+      sx = true;
+    }
+    break;
+  case INST_RRR:
+    if (is_op(inst, "slt")) {
+      sx = true;
+      bl = true;
+    } else if (is_op(inst, "and")) {
+      sx = is_sext[rs1] && is_sext[rs2];
+      bl = is_bool[rs1] || is_bool[rs2];
+    } else if (is_op(inst, "or") || is_op(inst, "xor")) {
+      sx = is_sext[rs1] && is_sext[rs2];
+      bl = is_bool[rs1] && is_bool[rs2];
+    } else if (is_op(inst, "addw") || is_op(inst, "subw") ||
+               is_op(inst, "mulw") || is_op(inst, "divw")) {
+      sx = true;
+    }
+    break;
+  case INST_LOAD:
+  case INST_LOAD_LO:
+    sx = is_op(inst, "lw") || is_op(inst, "lb");
+    break;
+  default:
+    break;
+  }
+
+  forget_reg(rd);
+  has_const[rd] = c;
+  const_val[rd] = val;
+  is_sext[rd] = sx;
+  is_bool[rd] = bl;
+}
+
+static void rewrite_insts(List *insts) {
+  forget_all();
+  Inst *prev = NULL; // 同じブロックでひとつ前の命令
+
+  for (int i = 0; i < insts->len; i++) {
+    Inst *inst = insts->data[i];
+
+    switch (inst->kind) {
+    case INST_LABEL:
+    case INST_RET:
+    case INST_TAIL:
+    case INST_JUMP:
+    case INST_JUMP_REG:
+      forget_all();
+      prev = NULL;
+      continue;
+    case INST_TEXT:
+    case INST_NOP:
+      continue;
+    case INST_CALL:
+      for (int rn = 1; rn < NUM_PHYS_REGS; rn++) {
+        if (is_caller_saved(rn)) {
+          forget_reg(rn);
+        }
+      }
+      mem_inst = NULL;
+      prev = NULL;
+      continue;
+    case INST_RRR:
+      rewrite_rrr(inst);
+      if (inst->kind == INST_RRI) {
+        rewrite_rri(inst);
+      }
+      if (inst->kind == INST_RR) {
+        rewrite_rr(inst, prev);
+      }
+      break;
+    case INST_RRI:
+      rewrite_rri(inst);
+      if (inst->kind == INST_RR) {
+        rewrite_rr(inst, prev);
+      }
+      break;
+    case INST_RR:
+      rewrite_rr(inst, prev);
+      break;
+    case INST_LOAD:
+      rewrite_load(inst);
+      if (inst->kind == INST_RR) {
+        rewrite_rr(inst, prev);
+      }
+      break;
+    case INST_STORE:
+      rewrite_store(inst);
+      break;
+    case INST_STORE_LO:
+    case INST_VEC:
+      mem_inst = NULL;
+      break;
+    case INST_BRANCH:
+      if (is_const(inst->rs1, 0)) {
+        inst->rs1 = 0;
+      }
+      if (inst->rs2 != -1) {
+        if (is_const(inst->rs2, 0)) {
+          inst->rs2 = 0;
+        }
+      }
+      break;
+    default:
+      break;
+    }
+
+    if (inst->kind == INST_NOP) {
+      continue;
+    }
+
+    note_def(inst);
+    if (inst->kind == INST_LOAD && inst->rd != inst->rs1) {
+      mem_inst = inst;
+    }
+    prev = inst;
+  }
+}
+
+static void live_use(char *live, int rn) {
+  if (rn > 0) {
+    live[rn] = 1;
+  }
+}
+
+// inst の直後で生きているレジスタ live を、直前のものにする
+static void live_transfer(Inst *inst, char *live) {
+  switch (inst->kind) {
+  case INST_CALL:
+    for (int rn = 1; rn < NUM_PHYS_REGS; rn++) {
+      if (is_caller_saved(rn)) {
+        live[rn] = 0;
+      }
+    }
+    for (int i = 0; i < inst->imm; i++) {
+      live[REG_A0 + i] = 1;
+    }
+    return;
+  case INST_TAIL:
+    // 呼ばれる関数が使うのは引数と、呼び出し元に返るための ra と s レジスタ
+    for (int rn = 1; rn < NUM_PHYS_REGS; rn++) {
+      live[rn] = rn == REG_RA || !is_caller_saved(rn);
+    }
+    for (int i = 0; i < inst->imm; i++) {
+      live[REG_A0 + i] = 1;
+    }
+    return;
+  case INST_RET:
+    // 呼び出し元が使うのは返り値と、ra と s レジスタ
+    for (int rn = 1; rn < NUM_PHYS_REGS; rn++) {
+      live[rn] = rn == REG_RA || rn == REG_A0 || !is_caller_saved(rn);
+    }
+    return;
+  case INST_JUMP_REG:
+    // 飛び先のわからない jr のあとは、どれも生きているものとする
+    for (int rn = 1; rn < NUM_PHYS_REGS; rn++) {
+      live[rn] = 1;
+    }
+    return;
+  case INST_LABEL:
+  case INST_JUMP:
+  case INST_TEXT:
+  case INST_NOP:
+    return;
+  default:
+    break;
+  }
+
+  if (inst->rd > 0) {
+    live[inst->rd] = 0;
+  }
+  live_use(live, inst->rs1);
+  live_use(live, inst->rs2);
+}
+
+// 結果のレジスタに書くほかに何もしない命令か
+static bool is_pure(Inst *inst) {
+  switch (inst->kind) {
+  case INST_RRR:
+  case INST_RRI:
+  case INST_RR:
+  case INST_LI:
+  case INST_LOAD:
+  case INST_LUI:
+  case INST_ADDI_LO:
+  case INST_LOAD_LO:
+    break;
+  default:
+    return false;
+  }
+
+  int rd = inst->rd;
+  return rd != 0 && rd != REG_RA && rd != REG_SP && rd != REG_FP;
+}
+
+// 命令列を基本ブロックに分けて生存解析し、結果が使われない命令を消す
+static void remove_dead_insts(List *insts) {
+  int n = insts->len;
+  int *block_start = arena_calloc(codegen_arena, n + 1, sizeof(int));
+  int *label_block = arena_calloc(codegen_arena, label_index + 1, sizeof(int));
+  int nblocks = 0;
+
+  for (int i = 0; i < n; i++) {
+    Inst *inst = insts->data[i];
+    bool starts = i == 0 || inst->kind == INST_LABEL;
+    if (i > 0) {
+      Inst *prev = insts->data[i - 1];
+      if (prev->kind == INST_BRANCH || prev->kind == INST_JUMP ||
+          prev->kind == INST_JUMP_REG || prev->kind == INST_RET ||
+          prev->kind == INST_TAIL) {
+        starts = true;
+      }
+    }
+    if (starts) {
+      block_start[nblocks] = i;
+      nblocks++;
+    }
+    if (inst->kind == INST_LABEL) {
+      label_block[inst->imm] = nblocks - 1;
+    }
+  }
+  block_start[nblocks] = n;
+
+  char *live_in = arena_calloc(codegen_arena, nblocks * NUM_PHYS_REGS + 1, 1);
+  char *live_out = arena_calloc(codegen_arena, nblocks * NUM_PHYS_REGS + 1, 1);
+  char *live = arena_calloc(codegen_arena, NUM_PHYS_REGS, 1);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (int b = nblocks - 1; b >= 0; b--) {
+      char *out = live_out + b * NUM_PHYS_REGS;
+      char *in = live_in + b * NUM_PHYS_REGS;
+      Inst *last = insts->data[block_start[b + 1] - 1];
+
+      // 後続のブロック。-1 ならなし
+      int succ1 = -1;
+      int succ2 = -1;
+      if (last->kind == INST_JUMP) {
+        succ1 = label_block[last->imm];
+      } else if (last->kind == INST_BRANCH) {
+        succ1 = label_block[last->imm];
+        if (b + 1 < nblocks) {
+          succ2 = b + 1;
+        }
+      } else if (last->kind != INST_RET && last->kind != INST_TAIL &&
+                 last->kind != INST_JUMP_REG && b + 1 < nblocks) {
+        succ1 = b + 1;
+      }
+
+      for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+        bool l = false;
+        if (succ1 != -1) {
+          char *succ_in = live_in + succ1 * NUM_PHYS_REGS;
+          l = l || succ_in[rn];
+        }
+        if (succ2 != -1) {
+          char *succ_in = live_in + succ2 * NUM_PHYS_REGS;
+          l = l || succ_in[rn];
+        }
+        out[rn] = l;
+        live[rn] = l;
+      }
+
+      for (int i = block_start[b + 1] - 1; i >= block_start[b]; i--) {
+        live_transfer(insts->data[i], live);
+      }
+
+      for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+        if (in[rn] != live[rn]) {
+          in[rn] = live[rn];
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for (int b = 0; b < nblocks; b++) {
+    char *out = live_out + b * NUM_PHYS_REGS;
+    for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+      live[rn] = out[rn];
+    }
+
+    for (int i = block_start[b + 1] - 1; i >= block_start[b]; i--) {
+      Inst *inst = insts->data[i];
+      if (is_pure(inst)) {
+        if (!live[inst->rd]) {
+          inst->kind = INST_NOP;
+          continue;
+        }
+      }
+      live_transfer(inst, live);
+    }
+  }
+}
+
+void peephole(List *insts) {
+  rewrite_insts(insts);
+  remove_dead_insts(insts);
+}
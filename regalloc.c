@@ -0,0 +1,358 @@
+// 仮想レジスタの割り当て
+//
+// IR の命令を出力順に並べて番号をふり、ブロックをまたぐ生存解析から
+// 仮想レジスタごとの生存区間を求めて linear scan で物理レジスタを割り当てる。
+// 関数呼び出しをまたいで生きるものは callee-saved の s1-s11 に、
+// そうでないものは caller-saved の t0-t4, a0-a7 に置く。
+// 足りなければフレーム上のスロットにスピルする。
+
+#include "mocc.h"
+
+#define NUM_CALLER_SAVED 13
+#define NUM_CALLEE_SAVED 11
+
+// t0-t2, a0-a7, t3-t4。t5, t6 はスピルした値の出し入れに使うので除く
+static int caller_saved_reg(int i) {
+  if (i < 3) {
+    return 5 + i;
+  }
+  if (i < 11) {
+    return REG_A0 + i - 3;
+  }
+  return 28 + i - 11;
+}
+
+// s1-s11
+static int callee_saved_reg(int i) {
+  if (i == 0) {
+    return 9;
+  }
+  return 18 + i - 1;
+}
+
+static bool is_callee_saved(int rn) {
+  return rn == 9 || (18 <= rn && rn <= 27);
+}
+
+// どこかのブロックで書く前に読む仮想レジスタ。ブロックの入口で生きうるのは
+// これだけ
+static char *live_exposed;
+
+static void live_mark_use(char *use, char *def, Reg *reg) {
+  if (reg == NULL) {
+    return;
+  }
+  if (!def[reg->vn]) {
+    use[reg->vn] = 1;
+    live_exposed[reg->vn] = 1;
+  }
+}
+
+static void live_mark_def(char *def, Reg *reg) {
+  if (reg == NULL) {
+    return;
+  }
+  def[reg->vn] = 1;
+}
+
+// ブロックの入口と出口で生きている仮想レジスタを求める
+void compute_liveness(IRFunc *fn) {
+  int nregs = fn->regs->len;
+  List *uses = list_new(); // of char *
+  List *defs = list_new(); // of char *
+  live_exposed = arena_calloc(codegen_arena, nregs + 1, 1);
+
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    bb->live_in = arena_calloc(codegen_arena, nregs + 1, 1);
+    bb->live_out = arena_calloc(codegen_arena, nregs + 1, 1);
+
+    char *use = arena_calloc(codegen_arena, nregs + 1, 1);
+    char *def = arena_calloc(codegen_arena, nregs + 1, 1);
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      live_mark_use(use, def, ir->a);
+      live_mark_use(use, def, ir->b);
+      if (ir->args != NULL) {
+        for (int k = 0; k < ir->args->len; k++) {
+          live_mark_use(use, def, ir->args->data[k]);
+        }
+      }
+      live_mark_def(def, ir->d);
+    }
+    list_append(uses, use);
+    list_append(defs, def);
+  }
+
+  int *globals = arena_calloc(codegen_arena, nregs + 1, sizeof(int));
+  int num_globals = 0;
+  for (int r = 0; r < nregs; r++) {
+    if (live_exposed[r]) {
+      globals[num_globals] = r;
+      num_globals++;
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (int i = fn->bbs->len - 1; i >= 0; i--) {
+      BB *bb = fn->bbs->data[i];
+      char *use = uses->data[i];
+      char *def = defs->data[i];
+
+      for (int j = 0; j < ir_num_succs(bb); j++) {
+        BB *succ = ir_succ(bb, j);
+        for (int k = 0; k < num_globals; k++) {
+          int r = globals[k];
+          if (succ->live_in[r]) {
+            bb->live_out[r] = 1;
+          }
+        }
+      }
+
+      for (int k = 0; k < num_globals; k++) {
+        int r = globals[k];
+        if (!bb->live_in[r]) {
+          if (use[r] || (bb->live_out[r] && !def[r])) {
+            bb->live_in[r] = 1;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void live_extend(Reg *reg, int pos) {
+  if (reg == NULL) {
+    return;
+  }
+
+  if (reg->start < 0 || pos < reg->start) {
+    reg->start = pos;
+  }
+  if (reg->end < pos) {
+    reg->end = pos;
+  }
+}
+
+// 生存区間を求める。命令ごとに番号を 2 つ使い、偶数で読んで奇数で書く。
+// これで、ある命令で最後に読まれるレジスタを同じ命令の結果に使いまわせる。
+// 返り値の配列は、位置ごとにそれより前で読まれる関数呼び出しの数
+static int *compute_intervals(IRFunc *fn) {
+  for (int i = 0; i < fn->regs->len; i++) {
+    Reg *reg = fn->regs->data[i];
+    reg->start = -1;
+    reg->end = -1;
+    reg->rn = -1;
+  }
+
+  int num_irs = 0;
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    num_irs += bb->irs->len;
+  }
+  int *calls_before = arena_calloc(codegen_arena, num_irs * 2 + 2, sizeof(int));
+
+  int pos = 0;
+  int ncalls = 0;
+  for (int i = 0; i < fn->bbs->len; i++) {
+    BB *bb = fn->bbs->data[i];
+    int bb_start = pos;
+
+    for (int j = 0; j < bb->irs->len; j++) {
+      IR *ir = bb->irs->data[j];
+      calls_before[pos] = ncalls;
+      if (ir->kind == IR_CALL) {
+        ncalls++;
+      }
+      calls_before[pos + 1] = ncalls;
+
+      live_extend(ir->a, pos);
+      live_extend(ir->b, pos);
+      if (ir->args != NULL) {
+        for (int k = 0; k < ir->args->len; k++) {
+          Reg *arg = ir->args->data[k];
+          live_extend(arg, pos);
+          arg->hint = REG_A0 + k;
+        }
+      }
+      live_extend(ir->d, pos + 1);
+
+      // 引数や返り値の受け渡しに使うレジスタにしておくと mv がいらない
+      if (ir->kind == IR_CALL) {
+        ir->d->hint = REG_A0;
+      }
+      if (ir->kind == IR_PARAM) {
+        ir->d->hint = REG_A0 + ir->imm;
+      }
+      if (ir->kind == IR_RET) {
+        if (ir->a != NULL) {
+          ir->a->hint = REG_A0;
+        }
+      }
+
+      pos += 2;
+    }
+
+    int bb_end = pos - 1;
+    for (int r = 0; r < fn->regs->len; r++) {
+      if (bb->live_in[r]) {
+        live_extend(fn->regs->data[r], bb_start);
+      }
+      if (bb->live_out[r]) {
+        live_extend(fn->regs->data[r], bb_end);
+      }
+    }
+  }
+  calls_before[pos] = ncalls;
+  calls_before[pos + 1] = ncalls;
+
+  return calls_before;
+}
+
+// 関数呼び出しの前後で生きているか。呼び出しは偶数の位置 c で引数を読み、
+// c + 1 で結果を書くので、start <= c < end となる c があるかをみる
+static bool crosses_call(Reg *reg, int *calls_before) {
+  return calls_before[reg->end] - calls_before[reg->start] > 0;
+}
+
+// start の昇順に並べる (マージソート)
+static void sort_by_start(Reg **regs, Reg **tmp, int n) {
+  if (n < 2) {
+    return;
+  }
+
+  int half = n / 2;
+  sort_by_start(regs, tmp, half);
+  sort_by_start(regs + half, tmp, n - half);
+
+  int i = 0;
+  int j = half;
+  for (int k = 0; k < n; k++) {
+    bool take_left;
+    if (j == n) {
+      take_left = true;
+    } else if (i == half) {
+      take_left = false;
+    } else {
+      Reg *left = regs[i];
+      Reg *right = regs[j];
+      take_left = left->start <= right->start;
+    }
+
+    if (take_left) {
+      tmp[k] = regs[i];
+      i++;
+    } else {
+      tmp[k] = regs[j];
+      j++;
+    }
+  }
+
+  for (int k = 0; k < n; k++) {
+    regs[k] = tmp[k];
+  }
+}
+
+static void spill(IRFunc *fn, Reg *reg) {
+  reg->rn = -1;
+  reg->spill_slot = fn->num_spill_slots;
+  fn->num_spill_slots++;
+}
+
+// 空いていて、区間 reg に使える物理レジスタを探す
+static int find_free_reg(Reg **owner, Reg *reg, bool crossing) {
+  if (!crossing && reg->hint >= 0) {
+    if (owner[reg->hint] == NULL) {
+      return reg->hint;
+    }
+  }
+
+  if (!crossing) {
+    for (int i = 0; i < NUM_CALLER_SAVED; i++) {
+      int rn = caller_saved_reg(i);
+      if (owner[rn] == NULL) {
+        return rn;
+      }
+    }
+  }
+
+  for (int i = 0; i < NUM_CALLEE_SAVED; i++) {
+    int rn = callee_saved_reg(i);
+    if (owner[rn] == NULL) {
+      return rn;
+    }
+  }
+
+  return -1;
+}
+
+void regalloc(IRFunc *fn) {
+  compute_liveness(fn);
+  int *calls_before = compute_intervals(fn);
+
+  fn->num_spill_slots = 0;
+  fn->used_regs = arena_calloc(codegen_arena, NUM_PHYS_REGS, 1);
+
+  int n = 0;
+  Reg **regs = arena_calloc(codegen_arena, fn->regs->len + 1, sizeof(Reg *));
+  Reg **tmp = arena_calloc(codegen_arena, fn->regs->len + 1, sizeof(Reg *));
+  for (int i = 0; i < fn->regs->len; i++) {
+    Reg *reg = fn->regs->data[i];
+    if (reg->start >= 0) {
+      regs[n] = reg;
+      n++;
+    }
+  }
+  sort_by_start(regs, tmp, n);
+
+  // 物理レジスタごとに、いまそれを使っている区間
+  Reg **owner = arena_calloc(codegen_arena, NUM_PHYS_REGS, sizeof(Reg *));
+
+  for (int i = 0; i < n; i++) {
+    Reg *reg = regs[i];
+    bool crossing = crosses_call(reg, calls_before);
+
+    // 終わった区間のレジスタを空ける
+    for (int rn = 0; rn < NUM_PHYS_REGS; rn++) {
+      if (owner[rn] != NULL) {
+        if (owner[rn]->end < reg->start) {
+          owner[rn] = NULL;
+        }
+      }
+    }
+
+    int rn = find_free_reg(owner, reg, crossing);
+    if (rn == -1) {
+      // 空きがないので、使えるレジスタのうちいちばん長く生きるものを
+      // スピルする。自分のほうが長く生きるなら自分をスピルする
+      Reg *victim = reg;
+      for (int r = 0; r < NUM_PHYS_REGS; r++) {
+        if (owner[r] == NULL) {
+          continue;
+        }
+        if (crossing && !is_callee_saved(r)) {
+          continue;
+        }
+        if (owner[r]->end > victim->end) {
+          victim = owner[r];
+        }
+      }
+
+      if (victim == reg) {
+        spill(fn, reg);
+        continue;
+      }
+
+      rn = victim->rn;
+      spill(fn, victim);
+    }
+
+    reg->rn = rn;
+    owner[rn] = reg;
+    fn->used_regs[rn] = 1;
+  }
+}
@@ -0,0 +1,235 @@
+// 命令の並べかえ
+//
+// in-order のコアでは、ロードや掛け算の結果をすぐ次の命令で使うと、結果が
+// 出るまでパイプラインが止まる。peephole のあとの命令列を、ラベル、分岐、
+// 関数呼び出しやベクトル命令などで区切った区間ごとにリストスケジューリング
+// して、依存のない命令をそのすきまに入れる。
+//
+// 依存は物理レジスタの読み書きと、メモリの読み書きの順序でつける。
+// sp か fp からの読み書きで場所が重ならないものは、たがいに入れかえてよい。
+// 毎サイクル、実行できる命令のうち、そこから区間の終わりまでの遅延が
+// いちばん長いものを選ぶ。同じなら元の順のものにする。
+//
+// -no-schedule で並べかえをやめる。
+
+#include "mocc.h"
+
+static List *sched_region; // of Inst *, 並べかえる区間
+
+// [i * n + j] は区間の i 番目から j 番目への依存の遅延 + 1。0 なら依存なし
+static int *sched_dep;
+
+// 結果が使えるようになるまでのサイクル数
+static int inst_latency(Inst *inst) {
+  if (inst->kind == INST_LOAD || inst->kind == INST_LOAD_LO) {
+    return 3;
+  }
+  if (inst->op == NULL ||
+      (inst->kind != INST_RRR && inst->kind != INST_RRI)) {
+    return 1;
+  }
+  if (strncmp(inst->op, "mul", 3) == 0) {
+    return 3;
+  }
+  if (strncmp(inst->op, "div", 3) == 0 || strncmp(inst->op, "rem", 3) == 0) {
+    return 16;
+  }
+  return 1;
+}
+
+// この命令で区間を区切る
+static bool is_sched_barrier(Inst *inst) {
+  switch (inst->kind) {
+  case INST_BRANCH:
+  case INST_JUMP:
+  case INST_JUMP_REG:
+  case INST_CALL:
+  case INST_RET:
+  case INST_TAIL:
+  case INST_LABEL:
+  case INST_TEXT:
+  case INST_VEC:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_mem_load(Inst *inst) {
+  return inst->kind == INST_LOAD || inst->kind == INST_LOAD_LO;
+}
+
+static bool is_mem_store(Inst *inst) {
+  return inst->kind == INST_STORE || inst->kind == INST_STORE_LO;
+}
+
+static bool reads_reg(Inst *inst, int rn) {
+  return rn > 0 && (inst->rs1 == rn || inst->rs2 == rn);
+}
+
+static bool writes_reg(Inst *inst, int rn) {
+  return rn > 0 && inst->rd == rn;
+}
+
+// ld, lw, lbu, sd, sw, sb などの 2 文字目から大きさを求める
+static int mem_size(Inst *inst) {
+  switch (inst->op[1]) {
+  case 'd':
+    return 8;
+  case 'w':
+    return 4;
+  case 'h':
+    return 2;
+  }
+  return 1;
+}
+
+// sp か fp からの、重ならない場所の読み書きか。base は区間の中で
+// 書きかえられていないこと
+static bool is_disjoint_frame_access(Inst *x, Inst *y, char *base_written) {
+  if (x->kind != INST_LOAD && x->kind != INST_STORE) {
+    return false;
+  }
+  if (y->kind != INST_LOAD && y->kind != INST_STORE) {
+    return false;
+  }
+  if (x->rs1 != y->rs1 || base_written[x->rs1]) {
+    return false;
+  }
+  if (x->rs1 != REG_SP && x->rs1 != REG_FP) {
+    return false;
+  }
+  return x->imm + mem_size(x) <= y->imm || y->imm + mem_size(y) <= x->imm;
+}
+
+// x のあとに y を実行しないといけないとき、その遅延 + 1 を返す
+static int sched_dep_latency(Inst *x, Inst *y, char *base_written) {
+  int lat = 0;
+  if (writes_reg(x, x->rd) && reads_reg(y, x->rd)) {
+    lat = inst_latency(x) + 1;
+  }
+  if (writes_reg(x, x->rd) && writes_reg(y, x->rd) && lat < 2) {
+    lat = 2;
+  }
+  if (writes_reg(y, y->rd) && reads_reg(x, y->rd) && lat < 1) {
+    lat = 1;
+  }
+
+  // ロードどうしは入れかえてよい
+  bool x_mem = is_mem_load(x) || is_mem_store(x);
+  bool y_mem = is_mem_load(y) || is_mem_store(y);
+  if (x_mem && y_mem && (is_mem_store(x) || is_mem_store(y)) &&
+      !is_disjoint_frame_access(x, y, base_written) && lat < 2) {
+    lat = 2;
+  }
+  return lat;
+}
+
+// 区間の命令を並べかえて out に追加する
+static void schedule_region(List *out) {
+  List *region = sched_region;
+  int n = region->len;
+  if (n <= 2) {
+    list_concat(out, region);
+    return;
+  }
+
+  char *base_written = arena_calloc(codegen_arena, NUM_PHYS_REGS, 1);
+  for (int i = 0; i < n; i++) {
+    Inst *inst = region->data[i];
+    if (inst->rd > 0) {
+      base_written[inst->rd] = 1;
+    }
+  }
+
+  sched_dep = arena_calloc(codegen_arena, n * n, sizeof(int));
+  int *num_preds = arena_calloc(codegen_arena, n, sizeof(int));
+  for (int j = 0; j < n; j++) {
+    for (int i = 0; i < j; i++) {
+      int lat = sched_dep_latency(region->data[i], region->data[j],
+                                  base_written);
+      sched_dep[i * n + j] = lat;
+      if (lat > 0) {
+        num_preds[j]++;
+      }
+    }
+  }
+
+  // そこから区間の終わりまでの遅延
+  int *height = arena_calloc(codegen_arena, n, sizeof(int));
+  for (int i = n - 1; i >= 0; i--) {
+    height[i] = inst_latency(region->data[i]);
+    for (int j = i + 1; j < n; j++) {
+      int lat = sched_dep[i * n + j];
+      if (lat > 0 && height[i] < lat - 1 + height[j]) {
+        height[i] = lat - 1 + height[j];
+      }
+    }
+  }
+
+  int *ready_at = arena_calloc(codegen_arena, n, sizeof(int));
+  char *done = arena_calloc(codegen_arena, n + 1, 1);
+  int cycle = 0;
+  for (int k = 0; k < n; k++) {
+    // 今のサイクルで実行できるもの。なければいちばん早く実行できるもの
+    int best = -1;
+    bool best_ready = false;
+    for (int i = 0; i < n; i++) {
+      if (done[i] || num_preds[i] > 0) {
+        continue;
+      }
+      bool ready = ready_at[i] <= cycle;
+      if (best == -1) {
+        best = i;
+        best_ready = ready;
+      } else if (ready && !best_ready) {
+        best = i;
+        best_ready = true;
+      } else if (ready == best_ready) {
+        if (ready && height[best] < height[i]) {
+          best = i;
+        } else if (!ready && ready_at[i] < ready_at[best]) {
+          best = i;
+        }
+      }
+    }
+
+    if (cycle < ready_at[best]) {
+      cycle = ready_at[best];
+    }
+    done[best] = 1;
+    list_append(out, region->data[best]);
+    for (int j = best + 1; j < n; j++) {
+      int lat = sched_dep[best * n + j];
+      if (lat > 0) {
+        num_preds[j]--;
+        if (ready_at[j] < cycle + lat - 1) {
+          ready_at[j] = cycle + lat - 1;
+        }
+      }
+    }
+    cycle++;
+  }
+}
+
+void schedule(List *insts) {
+  List *out = list_new();
+  sched_region = list_new();
+  for (int i = 0; i < insts->len; i++) {
+    Inst *inst = insts->data[i];
+    if (inst->kind == INST_NOP) {
+      continue;
+    }
+    if (is_sched_barrier(inst)) {
+      schedule_region(out);
+      sched_region = list_new();
+      list_append(out, inst);
+      continue;
+    }
+    list_append(sched_region, inst);
+  }
+  schedule_region(out);
+
+  insts->len = 0;
+  list_concat(insts, out);
+}
@@ -62,6 +62,8 @@ void test_arithmetic() {
   is(1, 123 != 321, "123 != 321");
 
   is(0, 65536 * 65536, "65536 * 65536 overflows");
+  is(-2147483647 - 1, 2147483647 + 1, "2147483647 + 1 wraps around");
+  is(2147483647, -2147483647 - 2, "-2147483647 - 2 wraps around");
 
   is(0, !42, "!42");
   is(1, !!42, "!!42");
@@ -78,6 +80,17 @@ void test_arithmetic() {
   is(1, 1 && 2, "1 && 2");
   is(1, 2 || 2, "2 || 2");
 
+  int sc = 0;
+  is(0, 0 && (sc = 1), "0 && (sc = 1)");
+  is(0, sc, "0 && (sc = 1) does not assign");
+  is(1, 1 || (sc = 2), "1 || (sc = 2)");
+  is(0, sc, "1 || (sc = 2) does not assign");
+  is(1, 0 || (sc = 3), "0 || (sc = 3)");
+  is(3, sc, "0 || (sc = 3) assigns");
+  if (sc == 3 || (sc = 4))
+    sc++;
+  is(4, sc, "if (sc == 3 || (sc = 4)) sc++");
+
   int a = 1;
   is(1, a++, "a = 1; a++");
   is(2, a++, "a++");
@@ -97,6 +110,164 @@ void test_arithmetic() {
   is(2, a, "a -= 99");
   a *= 1000;
   is(2000, a, "a *= 1000");
+
+  // 定数の乗除算はシフトと加減算、かけ算になる
+  int n = -12345;
+  is(-1234, n / 10, "n / 10");
+  is(-4115, n / 3, "n / 3");
+  is(1763, n / -7, "n / -7");
+  is(-1543, n / 8, "n / 8");
+  is(-86415, n * 7, "n * 7");
+  is(-111105, n * 9, "n * 9");
+  int m = 2147483647;
+  is(178956970, m / 12, "m / 12");
+  is(2147, m / 1000003, "m / 1000003");
+  is(-2147, (0 - m) / 1000003, "-m / 1000003");
+
+  // 左辺から評価するので、右に入れ子にした 32 個の値が同時に生きる
+  is(64528,
+     (a + 1) + ((a + 2) + ((a + 3) + ((a + 4) + ((a + 5) + ((a + 6) +
+     ((a + 7) + ((a + 8) + ((a + 9) + ((a + 10) + ((a + 11) + ((a + 12) +
+     ((a + 13) + ((a + 14) + ((a + 15) + ((a + 16) + ((a + 17) + ((a + 18) +
+     ((a + 19) + ((a + 20) + ((a + 21) + ((a + 22) + ((a + 23) + ((a + 24) +
+     ((a + 25) + ((a + 26) + ((a + 27) + ((a + 28) + ((a + 29) + ((a + 30) +
+     ((a + 31) + (a + 32))))))))))))))))))))))))))))))),
+     "(a + 1) + ((a + 2) + ...) needs more registers than available");
+}
+
+int f_switch_dense(int x) {
+  switch (x) {
+  case 1:
+    return 10;
+  case 2:
+    return 20;
+  case 3:
+  case 4:
+    return 34;
+  case 6:
+    return 60;
+  default:
+    return -1;
+  }
+}
+
+int f_switch_sparse(int x) {
+  int r = 0;
+  switch (x) {
+  case -100:
+    r = 1;
+    break;
+  case 7:
+    r = 2;
+    break;
+  case 300:
+    r = 3;
+    break;
+  case 4000:
+    r = 4;
+    break;
+  case 50000:
+    r = 5;
+  case 600000:
+    r += 6;
+  }
+  return r;
+}
+
+// 値の幅が int に収まらない、または端にある case
+int f_switch_int_max(int x) {
+  switch (x) {
+  case 2147483644:
+    return 1;
+  case 2147483645:
+    return 2;
+  case 2147483646:
+    return 3;
+  case 2147483647:
+    return 4;
+  }
+  return 0;
+}
+
+int f_switch_int_min(int x) {
+  switch (x) {
+  case -2147483647 - 1:
+    return 1;
+  case -2147483647:
+    return 2;
+  case -2147483646:
+    return 3;
+  case -2147483645:
+    return 4;
+  }
+  return 0;
+}
+
+int f_switch_wide(int x) {
+  switch (x) {
+  case -2000000000:
+    return 1;
+  case -1000000000:
+    return 2;
+  case 1000000000:
+    return 3;
+  case 2000000000:
+    return 4;
+  }
+  return 0;
+}
+
+int f_switch_extreme(int x) {
+  switch (x) {
+  case -2147483647:
+    return 1;
+  case 0:
+    return 2;
+  case 1:
+    return 3;
+  case 2:
+    return 4;
+  case 3:
+    return 5;
+  case 2147483647:
+    return 6;
+  }
+  return 0;
+}
+
+int f_switch_nested_case(int x, int y) {
+  int r = 0;
+  int i = 0;
+  switch (x) {
+  case 1:
+    r += 1;
+    if (y) {
+    case 2:
+      r += 10;
+    } else {
+      r += 100;
+    }
+    break;
+  default: {
+    r += 1000;
+  case 3:
+    r += 10000;
+    break;
+  }
+  case 4:
+    for (i = 0; i < 4; i++) {
+    case 5:
+      r += 2;
+    }
+    break;
+  case 6:
+    switch (y) {
+    case 6:
+      r += 20;
+    }
+    break;
+  }
+  return r;
 }
 
 void test_switch() {
@@ -118,6 +289,48 @@ void test_switch() {
   }
 
   is(10, i, "switch break");
+
+  is(-1, f_switch_dense(0), "f_switch_dense(0)");
+  is(10, f_switch_dense(1), "f_switch_dense(1)");
+  is(34, f_switch_dense(3), "f_switch_dense(3)");
+  is(34, f_switch_dense(4), "f_switch_dense(4)");
+  is(-1, f_switch_dense(5), "f_switch_dense(5)");
+  is(60, f_switch_dense(6), "f_switch_dense(6)");
+  is(-1, f_switch_dense(7), "f_switch_dense(7)");
+  is(-1, f_switch_dense(-5), "f_switch_dense(-5)");
+
+  is(1, f_switch_sparse(-100), "f_switch_sparse(-100)");
+  is(2, f_switch_sparse(7), "f_switch_sparse(7)");
+  is(4, f_switch_sparse(4000), "f_switch_sparse(4000)");
+  is(11, f_switch_sparse(50000), "f_switch_sparse(50000)");
+  is(6, f_switch_sparse(600000), "f_switch_sparse(600000)");
+  is(0, f_switch_sparse(8), "f_switch_sparse(8)");
+
+  is(1, f_switch_int_max(2147483644), "f_switch_int_max(2147483644)");
+  is(4, f_switch_int_max(2147483647), "f_switch_int_max(2147483647)");
+  is(0, f_switch_int_max(2147483643), "f_switch_int_max(2147483643)");
+  is(0, f_switch_int_max(-2147483647 - 1), "f_switch_int_max(INT_MIN)");
+  is(1, f_switch_int_min(-2147483647 - 1), "f_switch_int_min(INT_MIN)");
+  is(4, f_switch_int_min(-2147483645), "f_switch_int_min(-2147483645)");
+  is(0, f_switch_int_min(-2147483644), "f_switch_int_min(-2147483644)");
+  is(0, f_switch_int_min(2147483647), "f_switch_int_min(2147483647)");
+  is(1, f_switch_wide(-2000000000), "f_switch_wide(-2000000000)");
+  is(4, f_switch_wide(2000000000), "f_switch_wide(2000000000)");
+  is(0, f_switch_wide(0), "f_switch_wide(0)");
+  is(1, f_switch_extreme(-2147483647), "f_switch_extreme(-2147483647)");
+  is(5, f_switch_extreme(3), "f_switch_extreme(3)");
+  is(6, f_switch_extreme(2147483647), "f_switch_extreme(2147483647)");
+  is(0, f_switch_extreme(4), "f_switch_extreme(4)");
+
+  is(11, f_switch_nested_case(1, 1), "f_switch_nested_case(1, 1)");
+  is(101, f_switch_nested_case(1, 0), "f_switch_nested_case(1, 0)");
+  is(10, f_switch_nested_case(2, 0), "f_switch_nested_case(2, 0)");
+  is(10000, f_switch_nested_case(3, 0), "f_switch_nested_case(3, 0)");
+  is(8, f_switch_nested_case(4, 0), "f_switch_nested_case(4, 0)");
+  is(8, f_switch_nested_case(5, 0), "f_switch_nested_case(5, 0)");
+  is(20, f_switch_nested_case(6, 6), "f_switch_nested_case(6, 6)");
+  is(0, f_switch_nested_case(6, 7), "f_switch_nested_case(6, 7)");
+  is(11000, f_switch_nested_case(7, 0), "f_switch_nested_case(7, 0)");
 }
 
 int fact(int n) {
@@ -144,6 +357,17 @@ int f_if(int b, int x, int y) {
   }
 }
 
+int f_cond(int a, int b) {
+  int r = 0;
+  if (a < b && !(a == 0))
+    r += 1;
+  if (a >= b || b != 3)
+    r += 10;
+  while (a < b)
+    a++;
+  return r + a * 100;
+}
+
 int f_return_return(int val) {
   return val * 2;
   return val;
@@ -158,6 +382,115 @@ void f_empty_return() {
   return;
 }
 
+// s レジスタに収まらない数の変数が関数呼び出しをまたいで生きる
+int f_many_live(int x) {
+  int a = x + 1;
+  int b = x + 2;
+  int c = x + 3;
+  int d = x + 4;
+  int e = x + 5;
+  int f = x + 6;
+  int g = x + 7;
+  int h = x + 8;
+  int i = x + 9;
+  int j = x + 10;
+  int k = x + 11;
+  int l = x + 12;
+  int m = x + 13;
+  int n = add(a, m);
+  return a + b + c + d + e + f + g + h + i + j + k + l + m + n;
+}
+
+// 早く抜ける道ではフレームを作らない
+int f_early_return(int x, int y) {
+  if (x < 0) {
+    return y;
+  }
+  if (x == 0) {
+    return 0 - y;
+  }
+  int a = add(x, y);
+  return add(a, a);
+}
+
+// 小さい関数は呼び出し元に展開される
+int f_square(int x) {
+  return x * x;
+}
+
+int f_char_param(char c) {
+  return c;
+}
+
+int f_modify_param(int x) {
+  x = x + 1;
+  return x * 2;
+}
+
+int f_sum_ints(int *p, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++) {
+    s += p[i];
+  }
+  return s;
+}
+
+int f_sum_to(int n) {
+  int s = 0;
+  for (int i = 1; i < n + 1; i++) {
+    if (i == 5) {
+      return s;
+    }
+    s = s + i;
+  }
+  return s;
+}
+
+int f_tail_sum(int n, int acc) {
+  if (n == 0) {
+    return acc;
+  }
+  return f_tail_sum(n - 1, acc + 3);
+}
+
+int f_tail_swap(int a, int b, int n) {
+  if (n == 0) {
+    return a * 10 + b;
+  }
+  return f_tail_swap(b, a, n - 1);
+}
+
+int f_tail_char(char c, int n) {
+  if (n == 0) {
+    return c;
+  }
+  return f_tail_char(c + 100, n - 1);
+}
+
+void f_tail_fill(int *p, int n) {
+  if (n == 0) {
+    return;
+  }
+  p[n - 1] = n * n;
+  f_tail_fill(p, n - 1);
+}
+
+int f_tail_odd(int n);
+
+int f_tail_even(int n) {
+  if (n == 0) {
+    return 1;
+  }
+  return f_tail_odd(n - 1);
+}
+
+int f_tail_odd(int n) {
+  if (n == 0) {
+    return 0;
+  }
+  return f_tail_even(n - 1);
+}
+
 void test_func() {
   printf("# func\n");
   is(1, fact(0), "fact(0)");
@@ -175,9 +508,48 @@ void test_func() {
   is(50000, f_if(1, 50000, 60000), "f_if(1, 50000, 60000)");
   is(60000, f_if(0, 50000, 60000), "f_if(1, 50000, 60000)");
 
+  is(301, f_cond(1, 3), "f_cond(1, 3)");
+  is(510, f_cond(0, 5), "f_cond(0, 5)");
+  is(710, f_cond(7, 3), "f_cond(7, 3)");
+
   is(2, f_return_return(1), "f_return_return(1)");
 
   is(13, f_comment(), "f_comment()");
+
+  is(120, f_many_live(1), "f_many_live(1)");
+
+  is(7, f_early_return(-1, 7), "f_early_return(-1, 7)");
+  is(-7, f_early_return(0, 7), "f_early_return(0, 7)");
+  is(14, f_early_return(2, 5), "f_early_return(2, 5)");
+
+  is(9, f_square(3), "f_square(3)");
+  is(16, f_square(f_square(2)), "f_square(f_square(2))");
+  is(44, f_char_param(300), "f_char_param(300)");
+  int v = 3;
+  is(8, f_modify_param(v), "f_modify_param(v)");
+  is(3, v, "v after f_modify_param(v)");
+  is(10, f_sum_to(7), "f_sum_to(7)");
+
+  // 末尾呼び出しはスタックを伸ばさない
+  is(900000, f_tail_sum(300000, 0), "f_tail_sum(300000, 0)");
+  is(21, f_tail_swap(1, 2, 3), "f_tail_swap(1, 2, 3)");
+  is(45, f_tail_char(1, 3), "f_tail_char(1, 3)");
+  int sq[5];
+  f_tail_fill(sq, 5);
+  is(16, sq[3], "sq[3] after f_tail_fill(sq, 5)");
+  is(1, f_tail_even(200000), "f_tail_even(200000)");
+  is(1, f_tail_odd(200001), "f_tail_odd(200001)");
+}
+
+// 同じ式を何度も書いても、書きかえたあとは読みなおす
+int f_reread(int *p, int *q, int i) {
+  int a = p[i] + p[i];
+  p[i] = 7;
+  int b = p[i] * 10;
+  q[i] = 9;
+  int c = i + 1;
+  i = 0;
+  return a + b + p[i + 3] + c + (i + 1);
 }
 
 void test_array() {
@@ -205,6 +577,11 @@ void test_array() {
   is(4567, *(mat[9] + 11), "mat[9][11] = 4567; *(mat[9]+11)");
   is(4567, *(*(mat + 9) + 11), "mat[9][11] = 4567; *(*(mat+9)+11)");
 
+  a[3] = 5;
+  is(94, f_reread(a, a, 3), "f_reread(a, a, 3)");
+  is(50, (p + 50) - p, "(p + 50) - p");
+  is(-9, mat - (mat + 9), "mat - (mat + 9)");
+
   *(*(mat + 5) + 7) = 8901;
   is(8901, mat[5][7], "*(*(mat+5)+7) = 8901; mat[5][7]");
   is(8901, *(mat[5] + 7), "*(*(mat+5)+7) = 8901; *(mat[5]+7)");
@@ -215,6 +592,35 @@ void test_array() {
 
   *(mat[8] + 12) = 9999;
   is(9999, mat[8][12], "*(mat[8]+12) = 9999; mat[8][12]");
+
+  // ループの中のアドレス計算は、ループの前で求めたポインタを増やしていく
+  int grid[6][6];
+  for (int y = 0; y < 5; y++) {
+    for (int x = 0; x < 6; x++) {
+      grid[y][x] = y * 10 + x;
+    }
+  }
+  int total = 0;
+  for (int y = 4; y >= 0; y = y - 1) {
+    total = total + grid[y][5 - y];
+  }
+  is(115, total, "sum of grid[y][5 - y]");
+
+  int seq[10];
+  int k = 0;
+  while (k < 10) {
+    int *q = seq + k;
+    k = k + 1;
+    *q = k * 3;
+  }
+  is(3, seq[0], "seq[0] after while");
+  is(30, seq[9], "seq[9] after while");
+
+  char str[8];
+  for (int m = 0; m < 8; m++) {
+    str[m] = 'a' + m;
+  }
+  is('h', str[7], "str[7] after for");
 }
 
 void test_string_literal() {
@@ -233,6 +639,31 @@ void test_string_literal() {
   is(39, c2, "'\\'' == 39");
 }
 
+// 展開したときの比べる値が int からあふれるループ
+void test_for_overflow(int n) {
+  int count = 0;
+  for (int j = -2147483647 - 1; j < -2147483646; j++) {
+    count++;
+  }
+  is(2, count, "unrolled for from INT_MIN");
+  count = 0;
+  for (int j = 2147483640; j < 2147483647; j++) {
+    count++;
+  }
+  is(7, count, "unrolled for up to INT_MAX");
+  count = 0;
+  for (int j = 0; j < 5; j += 1000000000) {
+    count++;
+  }
+  is(1, count, "unrolled for with a huge step");
+  int five = n + 1;
+  count = 0;
+  for (int j = 0; j < five; j += 1000000000) {
+    count++;
+  }
+  is(1, count, "unrolled for with a huge step and a variable bound");
+}
+
 void test_for_while() {
   printf("# for while\n");
 
@@ -283,6 +714,79 @@ void test_for_while() {
   }
   is(42, sum, "for 1+..+9, skip 3");
 
+  sum = 0;
+  n = 0;
+  while (n < 10) {
+    n = n + 1;
+    if (n == 3)
+      continue;
+    sum = sum + n;
+  }
+  is(52, sum, "while 1+..+10, skip 3");
+
+  sum = 0;
+  while (n < 10) {
+    sum = sum + 1;
+  }
+  for (n = 5; n < 5; n = n + 1) {
+    sum = sum + 1;
+  }
+  is(0, sum, "loops whose condition is false at first");
+
+  // 展開されるループ。回数が割りきれないときは残りを元のループで回す
+  int vals[12];
+  for (int j = 0; j < 12; j++) {
+    vals[j] = j * j;
+  }
+  is(121, vals[11], "vals[11] after unrolled for");
+  sum = 0;
+  for (int j = 1; j < 12; j += 2) {
+    sum = sum + vals[j];
+  }
+  is(286, sum, "unrolled for with step 2");
+  int last = 10;
+  sum = 0;
+  for (int j = 3; j <= last; j++) {
+    if (j == 5)
+      continue;
+    if (j == 9)
+      break;
+    sum = sum + j;
+  }
+  is(28, sum, "unrolled for 3..8 with continue and break");
+
+  // -march=rv64gcv ではベクトル化される
+  int va[19];
+  int vb[19];
+  for (int j = 0; j < 19; j++) {
+    vb[j] = j;
+  }
+  int scale = 3;
+  for (int j = 0; j < 19; j++) {
+    va[j] = vb[j] * scale - vb[j] + 1;
+  }
+  is(37, va[18], "vectorized va[j] = vb[j] * scale - vb[j] + 1");
+  sum = 0;
+  int neg = 0;
+  for (int j = 0; j < 19; j++) {
+    sum += va[j];
+    neg -= vb[j];
+  }
+  is(361, sum, "vectorized sum of va");
+  is(-171, neg, "vectorized negative sum of vb");
+  is(171, f_sum_ints(vb, 19), "vectorized sum through a pointer");
+  char vc[40];
+  for (int j = 0; j < 40; j++) {
+    vc[j] = 'a';
+  }
+  int last_j;
+  for (last_j = 5; last_j <= last; last_j++) {
+    vc[last_j] = 20 - vc[last_j];
+  }
+  is(11, last_j, "loop variable after vectorized for");
+  is(-77, vc[10], "vectorized char elements");
+  is('a', vc[11], "vectorized char elements after the loop");
+
   int i = 0;
   for (;;) {
     i = i + 1;
@@ -290,6 +794,19 @@ void test_for_while() {
       break;
   }
   is(5, i, "for(;;) break at 5");
+
+  // ループで使う変数はレジスタに置かれるが、メモリと同じく型の幅に切りつめる
+  int big = 1;
+  char c = 0;
+  for (int k = 0; k < 32; k++) {
+    big = big * 2;
+    c = c + 8;
+  }
+  is(0, big, "int overflows after 32 doublings");
+  is(0, c, "char overflows after adding 8 32 times");
+  c = 127;
+  c++;
+  is(-128, c, "char c = 127; c++");
 }
 
 void test_pointer() {
@@ -313,11 +830,114 @@ void test_pointer() {
   is(8, sizeof(vp), "void *vp; sizeof(vp)");
 }
 
+// 命令の並べかえで、重なるかもしれない読み書きの順序が変わらないこと
+int f_sched_alias(int *p, int *q) {
+  *p = 1;
+  int a = *q;
+  *q = 2;
+  int b = *p;
+  *p = a * 10 + b;
+  return *q;
+}
+
+int f_sched_overlap(int n) {
+  int buf[2];
+  void *v = buf;
+  char *c = v;
+  buf[0] = n;
+  c[1] = 5;
+  buf[1] = buf[0];
+
+  // アドレスをとった変数は、となりあったスタックの場所に直接読み書きする
+  char c1 = n;
+  char c2 = n + 1;
+  int i1 = c1 + c2;
+  char *pc1 = &c1;
+  char *pc2 = &c2;
+  int *pi1 = &i1;
+  c2 = i1 * 2;
+  c1 = c2 + i1;
+  i1 = c1 + c2;
+  int r1 = *pc1;
+  int r2 = *pc2;
+  return buf[1] * 1000 + r1 + r2 + *pi1;
+}
+
+int f_sched_index(int *a, int i, int n) {
+  return a[i * 3] + a[n / 7] * 100;
+}
+
+void test_schedule() {
+  int x = 7;
+  int y = 7;
+  is(12, f_sched_alias(&x, &x), "f_sched_alias(&x, &x)");
+  is(12, x, "f_sched_alias(&x, &x); x");
+  is(2, f_sched_alias(&x, &y), "f_sched_alias(&x, &y)");
+  is(71, x, "f_sched_alias(&x, &y); x");
+
+  is(1282050, f_sched_overlap(2), "f_sched_overlap(2)");
+
+  int a[10];
+  for (int i = 0; i < 10; i++) {
+    a[i] = i * i;
+  }
+  is(409, f_sched_index(a, 1, 20), "f_sched_index(a, 1, 20)");
+  is(981, f_sched_index(a, x - 68, y + 22), "f_sched_index(a, 3, 24)");
+}
+
+int f_fold_called = 0;
+
+int f_fold_call() {
+  f_fold_called++;
+  return 1;
+}
+
+int f_dead_store(int a) {
+  int buf[2];
+  buf[0] = a;
+  buf[1] = 5;
+  int unused = a * 7;
+  int t = a + 1;
+  t = a * 3;
+  for (int i = 0; i < a; i++) {
+    unused = unused + i;
+    t++;
+  }
+  return t;
+  t = 0;
+  return t;
+}
+
 void test_var() {
   int a = 2;
   int b = a * 3;
   is(2, a, "int a = 2");
   is(6, b, "int b = a * 3");
+
+  int k = 3;
+  int k2 = k * 4 - 1;
+  char c = k2 + 'a';
+  is(11, k2, "int k2 = k * 4 - 1");
+  is('l', c, "char c = k2 + 'a'");
+  is(1, k2 == 11 && c == 'l', "k2 == 11 && c == 'l'");
+
+  int w = 5;
+  int w2 = w + 1;
+  w = w2 * 2;
+  is(12, w, "w = w2 * 2");
+
+  int r = 0;
+  if (k - 3) {
+    r = 1;
+  } else {
+    r = 2;
+  }
+  is(2, r, "if (k - 3)");
+  is(7, k ? 7 : f_fold_call(), "k ? 7 : f_fold_call()");
+  is(0, k == 4 && f_fold_call(), "k == 4 && f_fold_call()");
+  is(1, k < 4 || f_fold_call(), "k < 4 || f_fold_call()");
+  is(0, f_fold_called, "f_fold_call is not called");
+  is(16, f_dead_store(4), "f_dead_store(4)");
 }
 
 enum A { A1, A2, A3 };
@@ -441,10 +1061,17 @@ struct Struct1 gvar_5 = {98765};
 
 extern int ext_var;
 
+void f_bump_gvar_3() {
+  gvar_3 = gvar_3 + 1;
+}
+
 void test_global_var() {
   is(42, gvar_1, "gvar_1 = 42");
   is(-1, gvar_2, "gvar_2 = -1");
   is(0, gvar_3, "gvar_3");
+  f_bump_gvar_3();
+  is(1, gvar_3, "gvar_3 after f_bump_gvar_3()");
+  gvar_3 = 0;
   is(1, gvar_4[0], "gvar_4 = {1, 2, 3}; gvar_4[0]");
   is(0, gvar_4[4], "gvar_4 = {1, 2, 3}; gvar_4[4]");
   is(11111, ext_var, "extern int ext_var");
@@ -466,7 +1093,9 @@ int main() {
   test_array();
   test_string_literal();
   test_for_while();
+  test_for_overflow(4);
   test_pointer();
+  test_schedule();
   test_global_var();
   test_var();
   test_struct();
@@ -1,42 +1,74 @@
 #include "mocc.h"
 
-Token *curr_token;
-Token *prev_token;
+Token *tokens;
+int num_tokens;
+int token_pos;
+
+// tokenize で使う。できあがったら tokens に移す
+static Token *tok_buf;
+static int tok_cap;
+
+char *token_str(Token *tok) {
+  return user_input + tok->pos;
+}
+
+// 今の位置から n 個先のトークン。n が負なら、前に読んだもの
+Token *token_peek(int n) {
+  return &tokens[token_pos + n];
+}
 
 Token *token_consume(TokenKind kind) {
-  if (curr_token->kind != kind) {
+  Token *tok = &tokens[token_pos];
+  if (tok->kind != kind) {
     return NULL;
   }
 
-  prev_token = curr_token;
-  curr_token = curr_token->next;
-  return prev_token;
+  token_pos++;
+  return tok;
+}
+
+// 記号を 1 文字ずつ 256 進の数にする。3 文字までなので int に収まる
+static int punct_id(char *p, int len) {
+  int id = 0;
+  for (int i = 0; i < len; i++) {
+    int c = p[i];
+    id = id * 256 + c;
+  }
+  return id;
 }
 
 bool token_consume_punct(char *op) {
-  if (curr_token->kind != TK_PUNCT || curr_token->len != strlen(op) ||
-      strncmp(curr_token->str, op, curr_token->len) != 0) {
+  Token *tok = &tokens[token_pos];
+  if (tok->kind != TK_PUNCT) {
+    return false;
+  }
+  // パーサがいちばんよく呼ぶところなので、punct_id と同じ数をここで作る
+  int id = 0;
+  for (int i = 0; op[i]; i++) {
+    int c = op[i];
+    id = id * 256 + c;
+  }
+  if (tok->val != id) {
     return false;
   }
 
-  prev_token = curr_token;
-  curr_token = curr_token->next;
+  token_pos++;
   return true;
 }
 
 bool token_consume_type(char *type) {
-  if (curr_token->kind != TK_TYPE || curr_token->len != strlen(type) ||
-      strncmp(curr_token->str, type, curr_token->len) != 0) {
+  Token *tok = &tokens[token_pos];
+  if (tok->kind != TK_TYPE || tok->len != strlen(type) ||
+      strncmp(token_str(tok), type, tok->len) != 0) {
     return false;
   }
 
-  prev_token = curr_token;
-  curr_token = curr_token->next;
+  token_pos++;
   return true;
 }
 
 bool token_at_eof() {
-  return curr_token->kind == TK_EOF;
+  return tokens[token_pos].kind == TK_EOF;
 }
 
 void token_expect_punct(char *op) {
@@ -54,19 +86,19 @@ int token_expect_number() {
   return tok->val;
 }
 
-static Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
+// tok_buf の末尾にトークンを足す
+static Token *new_token(TokenKind kind, char *str, int len) {
+  if (num_tokens == tok_cap) {
+    tok_cap = tok_cap ? tok_cap * 2 : 1024;
+    tok_buf = realloc(tok_buf, sizeof(Token) * tok_cap);
+  }
+  Token *tok = &tok_buf[num_tokens];
+  num_tokens++;
   tok->kind = kind;
-  tok->str = str;
+  tok->val = 0;
+  tok->sym = 0;
+  tok->pos = str - user_input;
   tok->len = len;
-
-  cur->next = tok;
-  return tok;
-}
-
-static Token *new_token_num(Token *cur, int val) {
-  Token *tok = new_token(TK_NUM, cur, NULL, 0);
-  tok->val = val;
   return tok;
 }
 
@@ -74,10 +106,116 @@ static bool isident(char ch) {
   return isalnum(ch) || ch == '_';
 }
 
+// 記号の表。2 文字の記号は、先頭の文字ごとに続く文字を並べておく
+static char *punct_next[128];
+static bool punct_single[128];
+
+static void init_punct_table() {
+  char *singles = "+-*/()<>=;{},&[].!?:";
+  for (int i = 0; singles[i]; i++) {
+    int c = singles[i];
+    punct_single[c] = true;
+  }
+
+  punct_next['<'] = "=";
+  punct_next['>'] = "=";
+  punct_next['='] = "=";
+  punct_next['!'] = "=";
+  punct_next['|'] = "|";
+  punct_next['&'] = "&";
+  punct_next['-'] = ">-=";
+  punct_next['+'] = "+=";
+  punct_next['*'] = "=";
+}
+
+// p から始まる記号の長さ。記号でなければ 0
+static int punct_len(char *p) {
+  int c = *p;
+  if (c <= 0) {
+    return 0;
+  }
+  if (c == '.' && p[1] == '.' && p[2] == '.') {
+    return 3;
+  }
+
+  char *next = punct_next[c];
+  if (next != NULL && p[1] != '\0' && strchr(next, p[1]) != NULL) {
+    return 2;
+  }
+  if (punct_single[c]) {
+    return 1;
+  }
+  return 0;
+}
+
+static TokenKind match_keyword(char *p, char *word, TokenKind kind) {
+  if (strncmp(p, word, strlen(word)) == 0) {
+    return kind;
+  }
+  return TK_IDENT;
+}
+
+// 長さ len の識別子 p が予約語ならその種類を、そうでなければ TK_IDENT を返す。
+// 長さと先頭の文字で候補をひとつにしぼってから比べる
+static TokenKind keyword_kind(char *p, int len) {
+  switch (len) {
+  case 2:
+    return match_keyword(p, "if", TK_IF);
+  case 3:
+    if (*p == 'f') {
+      return match_keyword(p, "for", TK_FOR);
+    }
+    return match_keyword(p, "int", TK_TYPE);
+  case 4:
+    switch (*p) {
+    case 'c':
+      if (p[1] == 'a') {
+        return match_keyword(p, "case", TK_CASE);
+      }
+      return match_keyword(p, "char", TK_TYPE);
+    case 'e':
+      if (p[1] == 'l') {
+        return match_keyword(p, "else", TK_ELSE);
+      }
+      return match_keyword(p, "enum", TK_ENUM);
+    case 'v':
+      return match_keyword(p, "void", TK_TYPE);
+    }
+    return TK_IDENT;
+  case 5:
+    if (*p == 'w') {
+      return match_keyword(p, "while", TK_WHILE);
+    }
+    return match_keyword(p, "break", TK_BREAK);
+  case 6:
+    switch (*p) {
+    case 'r':
+      return match_keyword(p, "return", TK_RETURN);
+    case 'e':
+      return match_keyword(p, "extern", TK_EXTERN);
+    case 's':
+      if (p[1] == 'w') {
+        return match_keyword(p, "switch", TK_SWITCH);
+      }
+      if (p[1] == 'i') {
+        return match_keyword(p, "sizeof", TK_SIZEOF);
+      }
+      return match_keyword(p, "struct", TK_STRUCT);
+    }
+    return TK_IDENT;
+  case 7:
+    if (*p == 'd') {
+      return match_keyword(p, "default", TK_DEFAULT);
+    }
+    return match_keyword(p, "typedef", TK_TYPEDEF);
+  case 8:
+    return match_keyword(p, "continue", TK_CONTINUE);
+  }
+  return TK_IDENT;
+}
+
 void tokenize(char *p) {
-  Token head;
-  head.next = NULL;
-  Token *cur = &head;
+  init_punct_table();
 
   while (*p) {
     if (isspace(*p)) {
@@ -107,8 +245,8 @@ void tokenize(char *p) {
       } else {
         n = *p;
       }
-      cur = new_token(TK_NUM, cur, start, p - start + 1);
-      cur->val = n;
+      Token *tok = new_token(TK_NUM, start, p - start + 1);
+      tok->val = n;
       p++;
       if (*p != '\'') {
         error_at(p, "character is not closed");
@@ -129,7 +267,7 @@ void tokenize(char *p) {
           end += 2;
         }
       }
-      cur = new_token(TK_STRING, cur, p + 1, end - p - 1);
+      new_token(TK_STRING, p + 1, end - p - 1);
       p = end + 1;
       continue;
     }
@@ -150,133 +288,11 @@ void tokenize(char *p) {
       continue;
     }
 
-    if (strncmp(p, "<=", 2) == 0 || strncmp(p, ">=", 2) == 0 ||
-        strncmp(p, "==", 2) == 0 || strncmp(p, "!=", 2) == 0 ||
-        strncmp(p, "||", 2) == 0 || strncmp(p, "&&", 2) == 0 ||
-        strncmp(p, "->", 2) == 0 || strncmp(p, "++", 2) == 0 ||
-        strncmp(p, "--", 2) == 0 || strncmp(p, "+=", 2) == 0 ||
-        strncmp(p, "-=", 2) == 0 || strncmp(p, "*=", 2) == 0) {
-      cur = new_token(TK_PUNCT, cur, p, 2);
-      p += 2;
-      continue;
-    }
-
-    if (strncmp(p, "...", 3) == 0) {
-      cur = new_token(TK_PUNCT, cur, p, 3);
-      p += 3;
-      continue;
-    }
-
-    if (strchr("+-*/()<>=;{},&[].!?:", *p)) {
-      cur = new_token(TK_PUNCT, cur, p++, 1);
-      continue;
-    }
-
-    if (strncmp(p, "return", 6) == 0 && !isident(p[6])) {
-      cur = new_token(TK_RETURN, cur, p, 6);
-      p += 6;
-      continue;
-    }
-
-    if (strncmp(p, "if", 2) == 0 && !isident(p[2])) {
-      cur = new_token(TK_IF, cur, p, 2);
-      p += 2;
-      continue;
-    }
-
-    if (strncmp(p, "else", 4) == 0 && !isident(p[4])) {
-      cur = new_token(TK_ELSE, cur, p, 4);
-      p += 4;
-      continue;
-    }
-
-    if (strncmp(p, "switch", 6) == 0 && !isident(p[6])) {
-      cur = new_token(TK_SWITCH, cur, p, 6);
-      p += 6;
-      continue;
-    }
-
-    if (strncmp(p, "case", 4) == 0 && !isident(p[4])) {
-      cur = new_token(TK_CASE, cur, p, 4);
-      p += 4;
-      continue;
-    }
-
-    if (strncmp(p, "default", 7) == 0 && !isident(p[7])) {
-      cur = new_token(TK_DEFAULT, cur, p, 7);
-      p += 7;
-      continue;
-    }
-
-    if (strncmp(p, "while", 5) == 0 && !isident(p[5])) {
-      cur = new_token(TK_WHILE, cur, p, 5);
-      p += 5;
-      continue;
-    }
-
-    if (strncmp("for", p, 3) == 0 && !isident(p[3])) {
-      cur = new_token(TK_FOR, cur, p, 3);
-      p += 3;
-      continue;
-    }
-
-    if (strncmp("break", p, 5) == 0 && !isident(p[5])) {
-      cur = new_token(TK_BREAK, cur, p, 5);
-      p += 5;
-      continue;
-    }
-
-    if (strncmp("continue", p, 8) == 0 && !isident(p[8])) {
-      cur = new_token(TK_CONTINUE, cur, p, 8);
-      p += 8;
-      continue;
-    }
-
-    if (strncmp("sizeof", p, 6) == 0 && !isident(p[6])) {
-      cur = new_token(TK_SIZEOF, cur, p, 6);
-      p += 6;
-      continue;
-    }
-
-    if (strncmp("struct", p, 6) == 0 && !isident(p[6])) {
-      cur = new_token(TK_STRUCT, cur, p, 6);
-      p += 6;
-      continue;
-    }
-
-    if (strncmp("enum", p, 4) == 0 && !isident(p[4])) {
-      cur = new_token(TK_ENUM, cur, p, 4);
-      p += 4;
-      continue;
-    }
-
-    if (strncmp("typedef", p, 7) == 0 && !isident(p[7])) {
-      cur = new_token(TK_TYPEDEF, cur, p, 7);
-      p += 7;
-      continue;
-    }
-
-    if (strncmp("int", p, 3) == 0 && !isident(p[3])) {
-      cur = new_token(TK_TYPE, cur, p, 3);
-      p += 3;
-      continue;
-    }
-
-    if (strncmp("char", p, 4) == 0 && !isident(p[4])) {
-      cur = new_token(TK_TYPE, cur, p, 4);
-      p += 4;
-      continue;
-    }
-
-    if (strncmp("void", p, 4) == 0 && !isident(p[4])) {
-      cur = new_token(TK_TYPE, cur, p, 4);
-      p += 4;
-      continue;
-    }
-
-    if (strncmp("extern", p, 6) == 0 && !isident(p[6])) {
-      cur = new_token(TK_EXTERN, cur, p, 6);
-      p += 6;
+    int len = punct_len(p);
+    if (len > 0) {
+      Token *tok = new_token(TK_PUNCT, p, len);
+      tok->val = punct_id(p, len);
+      p += len;
       continue;
     }
 
@@ -286,20 +302,27 @@ void tokenize(char *p) {
         n++;
       }
 
-      cur = new_token(TK_IDENT, cur, p, n);
+      Token *tok = new_token(keyword_kind(p, n), p, n);
+      if (tok->kind == TK_IDENT) {
+        tok->sym = intern(p, n);
+      }
       p += n;
 
       continue;
     }
 
     if (isdigit(*p)) {
-      cur = new_token_num(cur, strtol(p, &p, 10));
+      char *start = p;
+      int val = strtol(p, &p, 10);
+      Token *tok = new_token(TK_NUM, start, p - start);
+      tok->val = val;
       continue;
     }
 
     error_at(p, "cannot tokenize: '%c'", *p);
   }
 
-  new_token(TK_EOF, cur, p, 0);
-  curr_token = head.next;
+  new_token(TK_EOF, p, 0);
+  tokens = tok_buf;
+  token_pos = 0;
 }
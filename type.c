@@ -2,10 +2,17 @@
 
 #include "mocc.h"
 
-List *globals;   // of Var *
-List *constants; // of Var *
+List *globals;       // of Var *
+List *constants;     // of Var *
+List *global_syms;   // of Var *, globals を名前の番号から引く
+List *constant_syms; // of Var *, constants を名前の番号から引く
 List *defined_types;
 
+// defined_types を種類ごとに名前の番号から引く表
+static List *struct_syms;  // of Type *
+static List *enum_syms;    // of Type *
+static List *typedef_syms; // of Type *
+
 char *type_to_string(Type *type) {
   char *buf = calloc(80, sizeof(char));
   if (type->ty == TY_INT) {
@@ -74,7 +81,7 @@ Var *add_var(List *vars, char *name, int len, Type *type, bool is_extern,
     offset = var->offset; //+ sizeof_type(var->type);
   }
 
-  Var *var = calloc(1, sizeof(Var));
+  Var *var = arena_calloc(type_arena, 1, sizeof(Var));
   var->name = name;
   var->len = len;
   var->scope_id = scope_id;
@@ -99,16 +106,49 @@ Var *add_var(List *vars, char *name, int len, Type *type, bool is_extern,
   return var;
 }
 
-Type *find_defined_type(char *name, int len) {
-  for (int i = 0; i < defined_types->len; i++) {
-    Type *type = defined_types->data[i];
-    if (type->name_len == len && strncmp(type->name, name, len) == 0 &&
-        type->ty == TY_TYPEDEF) {
-      return type;
-    }
+// ローカル変数を vars の最後に加える。名前の重なりは呼び出し元で調べる
+Var *add_lvar(List *vars, char *name, int len, Type *type, int scope_id) {
+  if (type->ty == TY_VOID) {
+    error("void is not a valid type");
   }
 
-  return NULL;
+  int offset = 0;
+  if (vars->len > 0) {
+    Var *last = vars->data[vars->len - 1];
+    offset = last->offset;
+  }
+
+  Var *var = arena_calloc(type_arena, 1, sizeof(Var));
+  var->name = name;
+  var->len = len;
+  var->scope_id = scope_id;
+  var->offset = offset + roundup_to_dword(sizeof_type(type));
+  var->type = type;
+
+  list_append(vars, var);
+
+  return var;
+}
+
+static List *defined_type_syms(TypeKind ty) {
+  if (typedef_syms == NULL) {
+    struct_syms = list_new();
+    enum_syms = list_new();
+    typedef_syms = list_new();
+  }
+
+  if (ty == TY_STRUCT) {
+    return struct_syms;
+  }
+  if (ty == TY_ENUM) {
+    return enum_syms;
+  }
+  return typedef_syms;
+}
+
+// 名前の番号 sym の typedef を探す
+Type *find_defined_type(int sym) {
+  return sym_lookup(defined_type_syms(TY_TYPEDEF), sym);
 }
 
 // 既存の型で、空のものがあったらその中身を埋めて返す
@@ -119,21 +159,20 @@ Type *add_or_find_defined_type(Type *type) {
     error("unnamed type: (%s)", type_to_string(type));
   }
 
-  for (int i = 0; i < defined_types->len; i++) {
-    Type *it = defined_types->data[i];
-    if (it->name_len == type->name_len &&
-        strncmp(it->name, type->name, type->name_len) == 0 &&
-        it->ty == type->ty) {
-      if (type->ty == TY_STRUCT && type->members != NULL) {
-        if (it->members != NULL) {
-          error("type already defined: '%.*s'", type->name_len, type->name);
-        }
-        it->members = type->members;
+  List *syms = defined_type_syms(type->ty);
+  int sym = intern(type->name, type->name_len);
+  Type *it = sym_lookup(syms, sym);
+  if (it != NULL) {
+    if (type->ty == TY_STRUCT && type->members != NULL) {
+      if (it->members != NULL) {
+        error("type already defined: '%.*s'", type->name_len, type->name);
       }
-      return it;
+      it->members = type->members;
     }
+    return it;
   }
 
+  sym_define(syms, sym, type);
   list_append(defined_types, type);
 
   return type;
@@ -43,10 +43,10 @@ noreturn void error_at(char *loc, char *fmt, ...) {
 noreturn void error(char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  if (!curr_token) {
+  if (tokens == NULL) {
     verror_at(NULL, fmt, ap);
   } else {
-    verror_at(curr_token->str, fmt, ap);
+    verror_at(token_str(token_peek(0)), fmt, ap);
   }
 }
 
@@ -78,4 +78,235 @@ int list_concat(List *list, List *other) {
     list_append(list, other->data[i]);
   }
   return list->len - 1;
-}
\ No newline at end of file
+}
+
+// 2 のべき乗なら指数を、そうでなければ -1 を返す
+int exact_log2(int val) {
+  if (val <= 0) {
+    return -1;
+  }
+  int p = 1;
+  for (int i = 0; i < 31; i++) {
+    if (p == val) {
+      return i;
+    }
+    // 2 の 30 乗の次は int からあふれる
+    if (p > INT_MAX / 2) {
+      break;
+    }
+    p *= 2;
+  }
+  return -1;
+}
+
+// a + b が int からあふれるか
+bool add_overflows(int a, int b) {
+  if (b < 0) {
+    return a < INT_MIN - b;
+  }
+  return a > INT_MAX - b;
+}
+
+// a - b が int からあふれるか
+bool sub_overflows(int a, int b) {
+  if (b < 0) {
+    return a > INT_MAX + b;
+  }
+  return a < INT_MIN + b;
+}
+
+// a * b が int からあふれるか
+bool mul_overflows(int a, int b) {
+  if (a == 0 || b == 0) {
+    return false;
+  }
+  if (a > 0) {
+    if (b > 0) {
+      return a > INT_MAX / b;
+    }
+    return b < INT_MIN / a;
+  }
+  if (b > 0) {
+    return a < INT_MIN / b;
+  }
+  return b < INT_MAX / a;
+}
+
+// 識別子の名前の intern。同じ名前には同じ番号を、0 から順にふる
+
+#define SYMBOL_HASH_SIZE 4096
+
+typedef struct Symbol Symbol;
+struct Symbol {
+  char *name;
+  int len;
+  int id;
+  Symbol *next; // 同じハッシュ値のもの
+};
+
+static Symbol **symbol_buckets;
+static int num_symbols;
+
+static int symbol_hash(char *name, int len) {
+  int h = 0;
+  for (int i = 0; i < len; i++) {
+    h = h * 31 + name[i];
+    h = h - h / SYMBOL_HASH_SIZE * SYMBOL_HASH_SIZE;
+  }
+  return h;
+}
+
+int intern(char *name, int len) {
+  if (symbol_buckets == NULL) {
+    symbol_buckets = calloc(SYMBOL_HASH_SIZE, sizeof(Symbol *));
+  }
+
+  int h = symbol_hash(name, len);
+  for (Symbol *sym = symbol_buckets[h]; sym; sym = sym->next) {
+    if (sym->len == len && strncmp(sym->name, name, len) == 0) {
+      return sym->id;
+    }
+  }
+
+  Symbol *sym = calloc(1, sizeof(Symbol));
+  sym->name = name;
+  sym->len = len;
+  sym->id = num_symbols;
+  sym->next = symbol_buckets[h];
+  symbol_buckets[h] = sym;
+  num_symbols++;
+  return sym->id;
+}
+
+// 名前の番号をキーにした表。番号は詰めてふってあるので、そのまま添字にする
+void *sym_lookup(List *table, int sym) {
+  if (sym < table->len) {
+    return table->data[sym];
+  }
+  return NULL;
+}
+
+void sym_assign(List *table, int sym, void *data) {
+  while (table->len <= sym) {
+    list_append(table, NULL);
+  }
+  table->data[sym] = data;
+}
+
+// 先に登録したものを優先する。すでにあれば何もしない
+void sym_define(List *table, int sym, void *data) {
+  if (sym_lookup(table, sym) == NULL) {
+    sym_assign(table, sym, data);
+  }
+}
+
+// アリーナ
+//
+// まとめて確保した領域から前から順に切り出す。個別には解放せず、
+// arena_reset でまとめて捨てる。捨てた領域は 0 で埋めなおして使いまわすので、
+// 切り出したところはいつも 0 で埋まっている。大きなものは別に確保する
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_LARGE_SIZE 16384
+
+struct Arena {
+  char *name;
+  List *chunks;   // of char *, 確保した ARENA_CHUNK_SIZE の領域
+  int next_chunk; // 次に使う chunks の番号
+  List *large;    // of char *, 別に確保した大きなもの
+  char *ptr;      // 今の領域の空いているところ
+  int left;       // 今の領域の残り
+  int used;       // 切り出した大きさの合計。arena_reset で 0 に戻る
+  int peak;       // used のこれまでの最大。arena_reset のときに更新する
+  int total;      // これまでに切り出した大きさの合計。同上
+};
+
+Arena *ast_arena;
+Arena *type_arena;
+Arena *codegen_arena;
+
+static List *arenas; // of Arena *
+
+static Arena *arena_new(char *name) {
+  Arena *arena = calloc(1, sizeof(Arena));
+  arena->name = name;
+  arena->chunks = list_new();
+  arena->large = list_new();
+  list_append(arenas, arena);
+  return arena;
+}
+
+void arena_init() {
+  arenas = list_new();
+  ast_arena = arena_new("ast");
+  type_arena = arena_new("type");
+  codegen_arena = arena_new("codegen");
+}
+
+void *arena_alloc(Arena *arena, int size) {
+  size = (size + 7) / 8 * 8;
+  arena->used += size;
+
+  if (size > ARENA_LARGE_SIZE) {
+    void *p = calloc(1, size);
+    list_append(arena->large, p);
+    return p;
+  }
+
+  if (arena->left < size) {
+    if (arena->next_chunk == arena->chunks->len) {
+      list_append(arena->chunks, calloc(1, ARENA_CHUNK_SIZE));
+    }
+    arena->ptr = arena->chunks->data[arena->next_chunk];
+    arena->next_chunk++;
+    arena->left = ARENA_CHUNK_SIZE;
+  }
+
+  void *p = arena->ptr;
+  arena->ptr = arena->ptr + size;
+  arena->left -= size;
+  return p;
+}
+
+// calloc と同じ引数で、arena から切り出す
+void *arena_calloc(Arena *arena, int n, int size) {
+  return arena_alloc(arena, n * size);
+}
+
+void arena_reset(Arena *arena) {
+  for (int i = 0; i < arena->large->len; i++) {
+    free(arena->large->data[i]);
+  }
+  arena->large->len = 0;
+
+  // 使ったところを 0 に戻す。最後の領域は残りの分を除く
+  for (int i = 0; i < arena->next_chunk; i++) {
+    int size = ARENA_CHUNK_SIZE;
+    if (i == arena->next_chunk - 1) {
+      size -= arena->left;
+    }
+    memset(arena->chunks->data[i], 0, size);
+  }
+  arena->next_chunk = 0;
+  arena->ptr = NULL;
+  arena->left = 0;
+
+  if (arena->peak < arena->used) {
+    arena->peak = arena->used;
+  }
+  arena->total += arena->used;
+  arena->used = 0;
+}
+
+void arena_print_stats() {
+  for (int i = 0; i < arenas->len; i++) {
+    Arena *arena = arenas->data[i];
+    int peak = arena->peak;
+    if (peak < arena->used) {
+      peak = arena->used;
+    }
+    fprintf(stderr, "arena %s: used=%d peak=%d total=%d chunks=%d\n",
+            arena->name, arena->used, peak, arena->total + arena->used,
+            arena->chunks->len);
+  }
+}